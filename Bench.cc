@@ -0,0 +1,408 @@
+#include <functional>
+#include <numeric>
+#include <thread>
+
+#include "Common.h"
+#include "ConcurrentIndex.h"
+#include "McRaveAgent.h"
+#include "NNAgent.h"
+#include "OpeningBook.h"
+#include "Position.h"
+#include "RNG.h"
+
+// Microbenchmarks of the hot paths. Every benchmark is seeded, runs a
+// warm-up and then `repeats` timed rounds, and reports ns per operation as
+// JSON (default) or CSV on stdout so results can be compared across commits.
+//
+// usage: bench [--repeats N] [--seed S] [--filter substring] [--csv]
+//              [--ann file.ann] [--qnn file.qnn]
+
+struct BenchResult {
+  string name;
+  long long ops;
+  vector<double> samples;  // ns per op, one per round
+
+  double mean() const {
+    return accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+  }
+
+  double stddev() const {
+    if (samples.size() < 2) return 0.0;
+    double m = mean(), sum = 0.0;
+    for (auto x : samples) sum += (x - m) * (x - m);
+    return sqrt(sum / (samples.size() - 1));
+  }
+
+  double median() const {
+    auto sorted = samples;
+    sort(sorted.begin(), sorted.end());
+    auto n = sorted.size();
+    return n % 2 ? sorted[n / 2] : 0.5 * (sorted[n / 2 - 1] + sorted[n / 2]);
+  }
+
+  double min() const { return *min_element(samples.begin(), samples.end()); }
+
+  // half width of the 95% confidence interval of the mean
+  double ci95() const { return 1.96 * stddev() / sqrt(samples.size()); }
+};
+
+struct BenchConfig {
+  int repeats = 15;
+  unsigned int seed = 12345;
+  string filter;
+  bool csv = false;
+  string ann;
+  string qnn;
+};
+
+// a round runs setup() untimed and then run(), which performs `ops` operations
+struct Bench {
+  string name;
+  long long ops;
+  function<void()> setup;
+  function<void()> run;
+};
+
+volatile uint64_t sink;
+
+template <typename T>
+long long sizeOf(const T &values) {
+  return static_cast<long long>(values.size());
+}
+
+BenchResult measure(const Bench &bench, int repeats) {
+  BenchResult result{bench.name, bench.ops, {}};
+  bench.setup();
+  bench.run();
+  for (int r = 0; r < repeats; ++r) {
+    bench.setup();
+    auto start = chrono::steady_clock::now();
+    bench.run();
+    auto end = chrono::steady_clock::now();
+    double ns = chrono::duration<double, nano>(end - start).count();
+    result.samples.push_back(ns / bench.ops);
+  }
+  return result;
+}
+
+void reseed(McRaveAgent &agent, unsigned int seed) {
+  agent.gen.engine.seed(seed);
+  StateInfo::rng.engine.seed(seed);
+}
+
+// positions from seeded random games, `perGame` consecutive ones from turn
+// `from` of each game
+vector<Position> samplePositions(RNG &gen, int games, int from, int perGame) {
+  vector<Position> positions;
+  for (int g = 0; g < games; ++g) {
+    Position pos;
+    Move move;
+    for (int t = 0; t < from + perGame && pos.getRandomMove(gen, move); ++t) {
+      if (t >= from) positions.push_back(pos);
+      pos.doMove(move);
+    }
+  }
+  return positions;
+}
+
+// a position reached after `turns` random moves, for the phase benchmarks
+Position positionAtTurn(unsigned int seed, int turns) {
+  RNG gen(seed);
+  Position pos;
+  Move move;
+  while (pos.turns < turns && pos.getRandomMove(gen, move)) pos.doMove(move);
+  return pos;
+}
+
+vector<Bench> positionBenches(const BenchConfig &config) {
+  RNG gen(config.seed);
+  auto positions =
+      make_shared<const vector<Position>>(samplePositions(gen, 200, 0, 40));
+  vector<pair<int, int>> zoneQueries;
+  vector<pair<Move, int>> moves;
+  for (int i = 0; i < static_cast<int>(positions->size()); ++i) {
+    const auto &pos = (*positions)[i];
+    for (int w = 0; w < 60; ++w) {
+      if (pos.isPossibleWall(w)) zoneQueries.emplace_back(w, i);
+    }
+    Move move;
+    if (pos.getRandomMove(gen, move)) moves.emplace_back(move, i);
+  }
+
+  vector<Bench> benches;
+  benches.push_back({"position/findZone", sizeOf(zoneQueries), [] {},
+                     [positions, zoneQueries] {
+                       uint64_t s = 0;
+                       for (auto [w, i] : zoneQueries) {
+                         s += (*positions)[i].findZone(w).size;
+                       }
+                       sink = s;
+                     }});
+  benches.push_back({"position/doMove", sizeOf(moves),
+                     [] {},
+                     [positions, moves] {
+                       uint64_t s = 0;
+                       for (const auto &[move, i] : moves) {
+                         auto tmp = (*positions)[i];
+                         tmp.doMove(move);
+                         s += tmp.wallsLength;
+                       }
+                       sink = s;
+                     }});
+  auto gen2 = make_shared<RNG>(config.seed);
+  benches.push_back({"position/getRandomMove", sizeOf(*positions),
+                     [gen2, seed = config.seed] { gen2->engine.seed(seed); },
+                     [positions, gen2] {
+                       uint64_t s = 0;
+                       Move move;
+                       for (const auto &pos : *positions) {
+                         if (pos.getRandomMove(*gen2, move)) s += move.wall;
+                       }
+                       sink = s;
+                     }});
+  benches.push_back({"position/moveIterator", sizeOf(*positions),
+                     [] {},
+                     [positions] {
+                       uint64_t s = 0;
+                       for (const auto &pos : *positions) {
+                         for (const auto &move : pos) s += move.wall;
+                       }
+                       sink = s;
+                     }});
+  benches.push_back({"common/transformState", 8 * sizeOf(*positions),
+                     [] {},
+                     [positions] {
+                       OpeningBookLookup book;
+                       uint64_t s = 0;
+                       for (int t = 0; t < 8; ++t) {
+                         book.transformationIndex = t;
+                         for (const auto &pos : *positions) {
+                           s ^= book.transformState(pos.placed);
+                         }
+                       }
+                       sink = s;
+                     }});
+  return benches;
+}
+
+vector<Bench> mcRaveBenches(const BenchConfig &config) {
+  vector<Bench> benches;
+  const auto seed = config.seed;
+
+  // select on the nodes of a tree grown from the empty board
+  auto agent = make_shared<McRaveAgent>();
+  reseed(*agent, seed);
+  Position root;
+  agent->me = 0;
+  for (int i = 0; i < 20000; ++i) agent->simulate(root);
+  vector<const StateInfo *> nodes;
+  agent->m.forEach(
+      [&nodes](State, const StateInfo &node) { nodes.push_back(&node); });
+  benches.push_back({"mcrave/StateInfo::select", sizeOf(nodes),
+                     [seed] { StateInfo::rng.engine.seed(seed); },
+                     [nodes, agent] {
+                       uint64_t s = 0;
+                       for (auto node : nodes) s += node->select();
+                       sink = s;
+                     }});
+
+  // backup of recorded iterations, they point into agent's tree and keep
+  // adding to it round after round like a long search would
+  constexpr int iterations = 2000;
+  auto results = make_shared<vector<IterationResult>>(iterations);
+  for (auto &result : *results) {
+    auto pos = root;
+    result.firstStateBlack = false;
+    agent->simulateTree(pos, result);
+    agent->simulateDefault(pos, result);
+  }
+  benches.push_back({"mcrave/backup", iterations, [] {},
+                     [agent, results] {
+                       for (const auto &result : *results) {
+                         agent->backup(result);
+                       }
+                     }});
+
+  constexpr int simulations = 2000;
+  for (auto [phase, turns] : {pair<const char *, int>{"opening", 0},
+                              {"middlegame", 15},
+                              {"endgame", 30}}) {
+    auto pos = positionAtTurn(seed, turns);
+    auto player = make_shared<McRaveAgent>();
+    benches.push_back({string("mcrave/simulate/") + phase, simulations,
+                       [player, pos, seed] {
+                         player->m.clear();
+                         reseed(*player, seed);
+                         player->me = pos.turns & 1;
+                       },
+                       [player, pos] {
+                         for (int i = 0; i < simulations; ++i) {
+                           player->simulate(pos);
+                         }
+                       }});
+  }
+  return benches;
+}
+
+vector<Bench> nnAgentBenches(const BenchConfig &config) {
+  srand(config.seed);
+  auto agent = config.ann.empty() ? make_shared<NNAgent>()
+                                  : make_shared<NNAgent>(config.ann);
+  if (!config.qnn.empty() && !agent->useQuantized(config.qnn)) return {};
+
+  RNG gen(config.seed);
+  auto positions = samplePositions(gen, 100, 0, 40);
+  auto states = make_shared<vector<State>>();
+  for (const auto &pos : positions) states->push_back(pos.state);
+
+  // every round starts from an empty cache, so each state is a miss once
+  vector<Bench> benches;
+  benches.push_back({"nnagent/estimate", sizeOf(*states),
+                     [agent] { agent->cache = make_shared<EvalCache>(); },
+                     [agent, states] {
+                       float s = 0.0f;
+                       for (auto state : *states) s += agent->estimate(state);
+                       sink = static_cast<uint64_t>(s);
+                     }});
+  benches.push_back({"nnagent/estimate/cached", sizeOf(*states),
+                     [agent, states] {
+                       for (auto state : *states) agent->estimate(state);
+                     },
+                     [agent, states] {
+                       float s = 0.0f;
+                       for (auto state : *states) s += agent->estimate(state);
+                       sink = static_cast<uint64_t>(s);
+                     }});
+  benches.push_back({"nnagent/estimate/batch32", sizeOf(*states),
+                     [agent] { agent->cache = make_shared<EvalCache>(); },
+                     [agent, states] {
+                       float values[32];
+                       for (size_t i = 0; i < states->size(); i += 32) {
+                         int n = min<size_t>(32, states->size() - i);
+                         agent->estimate(&(*states)[i], n, values);
+                       }
+                       sink = static_cast<uint64_t>(values[0]);
+                     }});
+  return benches;
+}
+
+// runs f(t) on threads threads and waits for them
+template <typename F>
+void runThreads(int threads, F f) {
+  vector<thread> workers;
+  for (int t = 0; t < threads; ++t) workers.emplace_back(f, t);
+  for (auto &worker : workers) worker.join();
+}
+
+vector<Bench> indexBenches(const BenchConfig &config) {
+  constexpr int log2Size = 21;
+  constexpr size_t keysCount = 1 << 19;
+  mt19937_64 engine(config.seed);
+  auto keys = make_shared<vector<State>>(keysCount);
+  for (auto &key : *keys) key = engine() >> 4;
+  sort(keys->begin(), keys->end());
+  keys->erase(unique(keys->begin(), keys->end()), keys->end());
+  shuffle(keys->begin(), keys->end(), engine);
+  auto index = make_shared<ConcurrentIndex>(log2Size);
+
+  vector<Bench> benches;
+
+  // a search-like mix over the same key space, a lookup and an insert on a
+  // miss per operation, split over 1 to 32 threads but no more threads than
+  // cores: past them the rounds time the scheduler
+  constexpr long long operations = 1 << 21;
+  const int cores = max(1u, thread::hardware_concurrency());
+  for (int threads : {1, 2, 4, 8, 16, 32}) {
+    if (threads > cores) break;
+    benches.push_back(
+        {"index/mixed/" + to_string(threads) + "threads", operations,
+         [index] { index->clear(); },
+         [index, keys, threads] {
+           const size_t n = keys->size();
+           atomic<uint64_t> total{0};
+           runThreads(threads, [&](int t) {
+             uint64_t s = 0;
+             for (auto i = t * operations / threads;
+                  i < (t + 1) * operations / threads; ++i) {
+               auto key = (*keys)[i * 7919 % n];
+               auto slot = index->find(key);
+               if (slot == ConcurrentIndex::notFound) {
+                 slot = index->insert(key).first;
+               }
+               s += slot;
+             }
+             total += s;
+           });
+           sink = total;
+         }});
+  }
+  return benches;
+}
+
+void printJson(const vector<BenchResult> &results, const BenchConfig &config) {
+  cout << fixed << setprecision(2);
+  cout << "{\"seed\": " << config.seed << ", \"repeats\": " << config.repeats
+       << ", \"unit\": \"ns/op\", \"benchmarks\": [";
+  for (size_t i = 0; i < results.size(); ++i) {
+    const auto &r = results[i];
+    cout << (i ? ",\n  " : "\n  ") << "{\"name\": \"" << r.name
+         << "\", \"ops\": " << r.ops << ", \"mean\": " << r.mean()
+         << ", \"median\": " << r.median() << ", \"min\": " << r.min()
+         << ", \"stddev\": " << r.stddev() << ", \"ci95\": " << r.ci95() << "}";
+  }
+  cout << "\n]}" << endl;
+}
+
+void printCsv(const vector<BenchResult> &results) {
+  cout << fixed << setprecision(2);
+  cout << "name,ops,mean,median,min,stddev,ci95" << endl;
+  for (const auto &r : results) {
+    cout << r.name << "," << r.ops << "," << r.mean() << "," << r.median()
+         << "," << r.min() << "," << r.stddev() << "," << r.ci95() << endl;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  BenchConfig config;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--csv") {
+      config.csv = true;
+    } else if (i + 1 == argc) {
+      break;
+    } else if (arg == "--repeats") {
+      config.repeats = max(1, stoi(argv[++i]));
+    } else if (arg == "--seed") {
+      config.seed = stoul(argv[++i]);
+    } else if (arg == "--filter") {
+      config.filter = argv[++i];
+    } else if (arg == "--ann") {
+      config.ann = argv[++i];
+    } else if (arg == "--qnn") {
+      config.qnn = argv[++i];
+    }
+  }
+
+  vector<Bench> benches;
+  for (auto group :
+       {positionBenches, mcRaveBenches, nnAgentBenches, indexBenches}) {
+    for (auto &bench : group(config)) {
+      if (bench.name.find(config.filter) != string::npos) {
+        benches.push_back(move(bench));
+      }
+    }
+  }
+
+  vector<BenchResult> results;
+  for (const auto &bench : benches) {
+    cerr << bench.name << "..." << endl;
+    results.push_back(measure(bench, config.repeats));
+  }
+
+  if (config.csv) {
+    printCsv(results);
+  } else {
+    printJson(results, config);
+  }
+  return 0;
+}
@@ -1,12 +1,19 @@
 #include <floatfann.h>
+#include <sys/resource.h>
 
+#include <atomic>
 #include <fstream>
 #include <future>
 #include <sstream>
 #include <thread>
 
 #include "Common.h"
+#include "ConcurrentQueue.h"
+#include "Elo.h"
+#include "ExampleStore.h"
 #include "NNAgent.h"
+#include "ReplayBuffer.h"
+#include "ThreadPool.h"
 
 using namespace std;
 
@@ -24,141 +31,274 @@ bool runGame(NNAgent x, NNAgent y) {
   return (pos.turns & 1);
 }
 
+double getCpuTime() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  auto seconds = [](const timeval &t) { return t.tv_sec + 1e-6 * t.tv_usec; };
+  return seconds(usage.ru_utime) + seconds(usage.ru_stime);
+}
+
+// Read-only weights and cache of one network, agents built from it on any
+// thread share them instead of copying the fann
+struct Snapshot {
+  Snapshot() = default;
+
+  explicit Snapshot(const NNAgent &agent)
+      : network(make_shared<const FloatNetwork>(agent.getFloatNetwork())),
+        cache(agent.cache) {}
+
+  NNAgent makeAgent() const { return NNAgent(network, cache); }
+
+  shared_ptr<const FloatNetwork> network;
+  shared_ptr<EvalCache> cache;
+};
+
+struct TrainingConfig {
+  size_t replayCapacity = ReplayBuffer::defaultCapacity;
+  int steps = 200;
+  unsigned int batchSize = 4096;
+  bool compressExamples = false;
+  // gating: SPRT of elo0 against elo1 truncated at maxPitGames, about 70
+  // games on average where a fixed match needs 139 for the same error rates
+  double elo0 = 0.0;
+  double elo1 = 100.0;
+  double alpha = 0.05;
+  double beta = 0.05;
+  int maxPitGames = 200;
+};
+
+const string examplesPath = "data/examples.bin";
+
 struct Coaching {
-  Coaching() : curr(), best(curr) {}
+  explicit Coaching(const TrainingConfig &config)
+      : curr(),
+        best(curr),
+        config(config),
+        replay(config.replayCapacity),
+        teacher(best) {}
+
+  // workers play self-play games with the current teacher until stopped,
+  // pit games are submitted to the same pool and take priority
+  void start() {
+    pool = make_unique<ThreadPool>(ThreadPool::defaultThreadsCount(),
+                                   [this] { playSelfPlayGame(); });
+    cout << "Self-play on " << pool->size() << " threads" << endl;
+  }
+
+  void stop() { pool.reset(); }
+
+  Snapshot getTeacher() {
+    lock_guard<mutex> lock(teacherMutex);
+    return teacher;
+  }
+
+  void setTeacher(const NNAgent &agent) {
+    Snapshot snapshot(agent);
+    lock_guard<mutex> lock(teacherMutex);
+    teacher = snapshot;
+  }
+
+  void playSelfPlayGame() {
+    auto agent = getTeacher().makeAgent();
+    vector<Example> episode;
+    agent.selfPlay(episode);
+    gamesPlayed.fetch_add(1, memory_order_relaxed);
+    episodes.push(move(episode));
+  }
 
   void init() {
     best = NNAgent("data/best.ann");
     curr = best;
-    ifstream in("data/examples.txt");
-    for (Example example; in >> example;) {
-      examples.push_back(example);
+    setTeacher(best);
+    const auto start = getTimePoint();
+    ExampleReader reader(examplesPath);
+    if (reader.isOpen()) {
+      for (vector<Example> chunk; reader.next(chunk);) {
+        for (const auto &example : chunk) replay.push(example);
+      }
+    } else {
+      // data written before the binary format existed
+      ifstream in("data/examples.txt");
+      for (Example example; in >> example;) {
+        replay.push(example);
+      }
     }
     cout << "Started from previous data" << endl;
-    cout << "With " << examples.size() << " example." << endl;
+    cout << "With " << replay.size() << " example. (" << getDeltaTimeSince(start)
+         << "s)" << endl;
   }
 
   void saveData() {
+    const auto start = getTimePoint();
     best.save("data/best.ann");
-    ofstream out("data/examples.txt");
-    for (const auto &example : examples) {
-      out << example << endl;
+    ExampleWriter writer(examplesPath, config.compressExamples);
+    for (size_t i = 0; i < replay.size(); ++i) {
+      writer.write(replay[i]);
     }
-    out.close();
+    if (!writer.close()) cerr << "Failed to save " << examplesPath << endl;
+    cout << "saved " << replay.size() << " examples in "
+         << getDeltaTimeSince(start) << "s" << endl;
   }
 
   // TODO: verify that the games are differents!!
-  double pit() {
-    constexpr int gamesCount = 20;
-    int wins = 0;
-    future<bool> results[gamesCount];
-    for (int i = 0; i < gamesCount; ++i) {
-      results[i] =
-          (i & 1) ? async(runGame, best, curr) : async(runGame, curr, best);
-    }
-
-    for (int i = 0; i < gamesCount; ++i) {
-      cerr << "game " << i;
-      if (i & 1)
-        cout << " as black=>";
-      else
-        cout << " as white=>";
-      bool whiteWins = results[i].get();
-      if (whiteWins) {
-        if (i & 1)
-          cerr << "candidate lost" << endl;
-        else {
-          ++wins;
-          cerr << "candidate wins" << endl;
-        }
-      } else {
-        if (!(i & 1))
-          cerr << "candidate lost" << endl;
-        else {
-          ++wins;
-          cerr << "candidate wins" << endl;
-        }
+  // Plays the candidate against the teacher in batches of parallel games until
+  // the SPRT decides, returns whether the candidate should be promoted. At
+  // maxPitGames the sign of the log-likelihood ratio decides.
+  bool pit() {
+    Sprt sprt(config.elo0, config.elo1, config.alpha, config.beta);
+    Snapshot candidate(curr);
+    auto incumbent = getTeacher();
+    int wins = 0, games = 0;
+    auto decision = Sprt::Continue;
+    while (decision == Sprt::Continue && games < config.maxPitGames) {
+      // pairs of games with swapped colours, the last batch may be odd
+      const int batchSize =
+          min(max(2, pool->size() & ~1), config.maxPitGames - games);
+      vector<future<bool>> results;
+      for (int i = 0; i < batchSize; ++i) {
+        bool candidateWhite = (i & 1) == 0;
+        results.push_back(pool->submit([candidate, incumbent, candidateWhite] {
+          bool whiteWins =
+              candidateWhite
+                  ? runGame(candidate.makeAgent(), incumbent.makeAgent())
+                  : runGame(incumbent.makeAgent(), candidate.makeAgent());
+          return whiteWins == candidateWhite;
+        }));
       }
+      for (auto &result : results) wins += result.get();
+      games += batchSize;
+      decision = sprt.decide(wins, games - wins);
     }
 
-    return static_cast<double>(wins) / static_cast<double>(gamesCount);
+    const auto llr = sprt.llr(wins, games - wins);
+    pitGames += games;
+    ++pits;
+    cerr << "pit games=" << games << " (" << pitGames << " in total, "
+         << static_cast<double>(pitGames) / pits << " per pit) wins="
+         << wins << " " << estimateElo(wins, games) << " llr=" << llr << " ("
+         << sprt.lower << ", " << sprt.upper << ") ";
+    if (decision == Sprt::AcceptH1) {
+      cerr << "candidate accepted" << endl;
+    } else if (decision == Sprt::AcceptH0) {
+      cerr << "candidate rejected" << endl;
+    } else {
+      cerr << "undecided, candidate " << (llr > 0.0 ? "accepted" : "rejected")
+           << " on the sign of llr" << endl;
+    }
+    return decision == Sprt::AcceptH1 ||
+           (decision == Sprt::Continue && llr > 0.0);
   }
 
   void train(int iteration) {
     constexpr int episodesCount = 10;
-    future<list<Example>> results[episodesCount];
-    for (int e = 0; e < episodesCount; ++e) {
-      results[e] = async([this]() {
-        list<Example> episodeExamples;
-        auto master = best;
-        master.selfPlay(episodeExamples);
-        return episodeExamples;
-      });
+    const auto start = getTimePoint();
+    const auto cpuStart = getCpuTime();
+    const auto gamesStart = gamesPlayed.load();
+
+    // wait for enough fresh games, then take whatever else is already queued
+    int collected = 0;
+    auto consume = [&](const vector<Example> &episode) {
+      for (const auto &example : episode) replay.push(example);
+      ++collected;
+    };
+    while (collected < episodesCount) {
+      consume(episodes.pop());
     }
-    // TODO: Check that games in self play are differents!!
-    for (int e = 0; e < episodesCount; ++e) {
-      cout << "episode " << e << " ..";
-      cout.flush();
-      auto episodeExamples = results[e].get();
-      for (const auto &example : episodeExamples) {
-        examples.push_back(example);
-      }
-      cout << "done!" << endl;
+    for (vector<Example> episode; episodes.tryPop(episode);) {
+      consume(episode);
     }
+    // TODO: Check that games in self play are differents!!
+    cout << "collected " << collected << " episodes" << endl;
+    cout << "self-play " << *best.cache << endl;
+    best.cache->resetStats();
 
-    cout << "training with " << examples.size() << " examples .." << endl;
-    auto train_data = createTrainData();
-    curr.train(train_data);
-    auto winRate = pit();
-    cerr << "winRate=" << 100 * winRate << "%" << endl;
-    if (winRate >= 0.55) {
+    cout << "training with " << replay.size() << " examples .." << endl;
+    auto mse = curr.train(config.steps, config.batchSize,
+                          [this](fann_train_data *batch) { fillBatch(batch); });
+    cout << "mse=" << mse << endl;
+    bool promote = pit();
+    cerr << "pit candidate " << *curr.cache << " best " << *best.cache << endl;
+    curr.cache->resetStats();
+    best.cache->resetStats();
+    if (promote) {
       cerr << "A better agent found" << endl;
       best = curr;
+      setTeacher(best);
       ostringstream stream;
       stream << "data/" << iteration << ".ann";
       best.save(stream.str());
     }
-  }
 
-  fann_train_data *createTrainData() {
-    while (examples.size() > 25000) {
-      examples.pop_front();
-    }
+    auto dt = getDeltaTimeSince(start);
+    auto games = gamesPlayed.load() - gamesStart;
+    auto cpu = (getCpuTime() - cpuStart) / (dt * pool->size());
+    cout << "self-play games=" << games << " " << games / dt
+         << " games/s cpu=" << 100.0 * cpu << "%" << endl;
+  }
 
-    vector<Example> sample;
-    std::sample(examples.begin(), examples.end(), std::back_inserter(sample),
-                2500, std::mt19937{std::random_device{}()});
-
-    auto train_data = fann_create_train(8 * sample.size(), 60, 1);
-    auto i = 0u;
-    for (const auto &[state, result] : sample) {
-      for (const auto s : getAllTransformations(state)) {
-        for (auto w = 0u; w < 60; ++w) {
-          if (contains(s, w)) {
-            train_data->input[i][w] = 1.0f;
-          } else {
-            train_data->input[i][w] = 0.0f;
-          }
-        }
-        train_data->output[i][0] = result;
-        i += 1;
+  void fillBatch(fann_train_data *batch) {
+    for (auto i = 0u; i < batch->num_data; ++i) {
+      const auto &[state, result] = replay.sample(gen);
+      // one random symmetric image per draw instead of storing all 8
+      auto s = getTransformation(state, gen.lessThan(8));
+      for (auto w = 0u; w < 60; ++w) {
+        batch->input[i][w] = contains(s, w) ? 1.0f : 0.0f;
       }
+      batch->output[i][0] = result;
     }
-
-    fann_shuffle_train_data(train_data);
-    return train_data;
   }
 
   NNAgent curr;
   NNAgent best;
-  list<Example> examples;
+  TrainingConfig config;
+  ReplayBuffer replay;
+  RNG gen;
+  Snapshot teacher;
+  mutex teacherMutex;
+  ConcurrentQueue<vector<Example>> episodes;
+  atomic<int> gamesPlayed{0};
+  long long pitGames = 0;
+  int pits = 0;
+  // last member: its threads must stop before the state they use goes away
+  unique_ptr<ThreadPool> pool;
 };
 
 int main(int argc, char *argv[]) {
-  Coaching coaching;
-  if (argc > 1 && string(argv[1]) == "--continue") {
+  bool resume = false;
+  TrainingConfig config;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--continue") {
+      resume = true;
+    } else if (arg == "--replay-capacity" && i + 1 < argc) {
+      config.replayCapacity = stoul(argv[++i]);
+    } else if (arg == "--train-steps" && i + 1 < argc) {
+      config.steps = stoi(argv[++i]);
+    } else if (arg == "--batch-size" && i + 1 < argc) {
+      config.batchSize = stoul(argv[++i]);
+    } else if (arg == "--max-pit-games" && i + 1 < argc) {
+      config.maxPitGames = max(2, stoi(argv[++i]));
+    } else if (arg == "--pit-elo0" && i + 1 < argc) {
+      config.elo0 = stod(argv[++i]);
+    } else if (arg == "--pit-elo1" && i + 1 < argc) {
+      config.elo1 = stod(argv[++i]);
+    } else if (arg == "--pit-alpha" && i + 1 < argc) {
+      config.alpha = stod(argv[++i]);
+    } else if (arg == "--pit-beta" && i + 1 < argc) {
+      config.beta = stod(argv[++i]);
+    } else if (arg == "--compress-examples") {
+      config.compressExamples = true;
+    } else if (arg == "--convert-examples" && i + 2 < argc) {
+      bool compress = i + 3 < argc && argv[i + 3] == string("--compress");
+      return convertExamples(argv[i + 1], argv[i + 2], compress) ? 0 : 1;
+    }
+  }
+
+  Coaching coaching(config);
+  if (resume) {
     coaching.init();
   }
+  coaching.start();
 
   int maxIterations;
   cout << "Please give max iterations:" << endl;
@@ -168,6 +308,7 @@ int main(int argc, char *argv[]) {
     coaching.train(i);
     if (i % 10 == 0) coaching.saveData();
   }
+  coaching.stop();
 
   cout << "A sample game of slef play with best one" << endl;
   cout << "moves=";
@@ -13,6 +13,10 @@
 #include <unordered_map>
 #include <vector>
 
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
 using Square = int;
@@ -228,6 +232,53 @@ const vector<pair<Bitmask, Bitmask>> neighborsBitmasksOfWall{
     {0x0010000001800000u, 0x0000000030000000u},
     {0x0020000001000000u, 0x0000000020000000u}};
 
+// Square (r, c) is 5r + c. It is bounded by the horizontal walls 5r + c and
+// 5r + c + 5 and by the vertical walls 30 + 6r + c and 30 + 6r + c + 1, so a
+// bitmask of squares maps to its walls with shifts and bit deposits.
+constexpr Bitmask allSquaresBitmask = (1ull << 25) - 1;
+constexpr Bitmask firstRowSquares = 0x1Full;
+constexpr Bitmask lastRowSquares = firstRowSquares << 20;
+constexpr Bitmask firstColumnSquares = 0x108421ull;
+constexpr Bitmask lastColumnSquares = firstColumnSquares << 4;
+// vertical walls shifted down by 30, one row of 6 every 6 bits
+constexpr Bitmask leftWallsOfRows = 0x1F7DF7DFull;
+constexpr Bitmask rightWallsOfRows = leftWallsOfRows << 1;
+
+inline Bitmask depositBits(Bitmask source, Bitmask mask) {
+#if defined(__BMI2__)
+  return _pdep_u64(source, mask);
+#else
+  Bitmask result = emptyBitmask;
+  for (Bitmask bit = 1; mask; bit <<= 1, mask &= mask - 1) {
+    if (source & bit) result |= mask & -mask;
+  }
+  return result;
+#endif
+}
+
+inline Bitmask extractBits(Bitmask source, Bitmask mask) {
+#if defined(__BMI2__)
+  return _pext_u64(source, mask);
+#else
+  Bitmask result = emptyBitmask;
+  for (Bitmask bit = 1; mask; bit <<= 1, mask &= mask - 1) {
+    if (source & mask & -mask) result |= bit;
+  }
+  return result;
+#endif
+}
+
+// the zone made of these squares: walls is the or of wallsBitmaskOfSquare,
+// border its xor
+inline Zone zoneOfSquares(Bitmask squares) {
+  auto top = squares;
+  auto bottom = squares << 5;
+  auto left = depositBits(squares, leftWallsOfRows) << 30;
+  auto right = depositBits(squares, rightWallsOfRows) << 30;
+  return {__builtin_popcountll(squares), squares, top | bottom | left | right,
+          top ^ bottom ^ left ^ right};
+}
+
 using TimePoint = std::chrono::system_clock::time_point;
 
 inline TimePoint getTimePoint() { return std::chrono::system_clock::now(); }
@@ -278,6 +329,18 @@ struct Stats {
     if (s.visits == 0) return;
     update(-s.value, s.visits);
   }
+
+  // takes back s, added before with update or +=
+  inline void remove(const Stats &s) {
+    if (s.visits == 0) return;
+    if (s.visits >= visits) {
+      *this = Stats();
+      return;
+    }
+    value = (value * visits - s.value * s.visits) / (visits - s.visits);
+    value = clamp(value, -1.0f, 1.0f);
+    visits -= s.visits;
+  }
 };
 
 inline ostream &operator<<(ostream &out, const Stats &stats) {
@@ -338,17 +401,25 @@ constexpr int transformations[8][60] = {
 
 constexpr int inverse[8] = {0, 3, 2, 1, 4, 5, 6, 7};
 
+inline State getTransformation(State state, int i) {
+  State s = emptyBitmask;
+  for (int w = 0; w < 60; ++w) {
+    if (contains(state, w)) {
+      add(s, transformations[i][w]);
+    }
+  }
+  return s;
+}
+
 inline vector<State> getAllTransformations(State state) {
   vector<State> result(8);
   for (auto i = 0; i < 8; ++i) {
-    State s = emptyBitmask;
-    for (int w = 0; w < 60; ++w) {
-      if (contains(state, w)) {
-        add(s, transformations[i][w]);
-      }
-    }
-    result[i] = s;
+    result[i] = getTransformation(state, i);
   }
 
   return result;
 }
+
+inline State getCanonicalState(const vector<State> &images) {
+  return *min_element(images.begin(), images.end());
+}
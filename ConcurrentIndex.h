@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <stdexcept>
+
+#include "Common.h"
+
+// Fixed-capacity index from states to slot numbers, shared by the threads of a
+// parallel search without locks. Open addressing with linear probing: a key is
+// claimed by a CAS on its 64-bit slot and then never moves or leaves, so a
+// slot number stays valid for the life of the index and can address an array
+// of nodes. States use 60 bits, the all-ones word marks an empty slot.
+//
+// The thread claiming a slot is the one to build its node. Others may find
+// the slot before the node is ready, so nodes publish themselves (e.g. with a
+// status written last with release order).
+struct ConcurrentIndex {
+  static constexpr State empty = ~State{0};
+  static constexpr uint32_t notFound = ~0u;
+  // longest probe sequence, an insert going further reports a full index
+  static constexpr int maxProbes = 64;
+
+  // slot numbers are 32 bits and notFound is the last of them
+  static constexpr int maxLog2Size = 31;
+
+  // throws invalid_argument when log2Size is not in [1, maxLog2Size]
+  explicit ConcurrentIndex(int log2Size)
+      : shift(64 - checkedLog2Size(log2Size)), mask((1ull << log2Size) - 1),
+        keys(1ull << log2Size) {
+    clear();
+  }
+
+  size_t capacity() const { return keys.size(); }
+  size_t size() const { return count.load(memory_order_relaxed); }
+
+  // the slot of key, or notFound
+  uint32_t find(State key) const {
+    auto i = index(key);
+    for (int probe = 0; probe < maxProbes; ++probe, i = (i + 1) & mask) {
+      auto k = keys[i].load(memory_order_acquire);
+      if (k == key) return static_cast<uint32_t>(i);
+      if (k == empty) break;
+    }
+    return notFound;
+  }
+
+  // the slot of key and whether this call claimed it, notFound when the
+  // index is too full around the key
+  pair<uint32_t, bool> insert(State key) {
+    auto i = index(key);
+    for (int probe = 0; probe < maxProbes; ++probe, i = (i + 1) & mask) {
+      auto k = keys[i].load(memory_order_acquire);
+      if (k == empty &&
+          keys[i].compare_exchange_strong(k, key, memory_order_acq_rel,
+                                          memory_order_acquire)) {
+        count.fetch_add(1, memory_order_relaxed);
+        return {static_cast<uint32_t>(i), true};
+      }
+      // k is the key in the slot, possibly just written by another thread
+      if (k == key) return {static_cast<uint32_t>(i), false};
+    }
+    return {notFound, false};
+  }
+
+  // not thread-safe, for reuse between searches
+  void clear() {
+    for (auto &key : keys) key.store(empty, memory_order_relaxed);
+    count.store(0, memory_order_relaxed);
+  }
+
+  static int checkedLog2Size(int log2Size) {
+    if (log2Size < 1 || log2Size > maxLog2Size) {
+      throw invalid_argument("ConcurrentIndex: log2Size " +
+                             to_string(log2Size) + " is not in [1, 31]");
+    }
+    return log2Size;
+  }
+
+  size_t index(State key) const {
+    return (key * 0x9E3779B97F4A7C15ull) >> shift;
+  }
+
+  const int shift;
+  const size_t mask;
+  vector<atomic<State>> keys;
+  atomic<size_t> count{0};
+};
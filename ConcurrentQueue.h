@@ -0,0 +1,44 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+#include "Common.h"
+
+// Unbounded multi-producer / multi-consumer queue.
+template <typename T>
+struct ConcurrentQueue {
+  void push(T value) {
+    {
+      lock_guard<mutex> lock(m);
+      items.push_back(move(value));
+    }
+    cv.notify_one();
+  }
+
+  T pop() {
+    unique_lock<mutex> lock(m);
+    cv.wait(lock, [this] { return !items.empty(); });
+    T value = move(items.front());
+    items.pop_front();
+    return value;
+  }
+
+  bool tryPop(T &value) {
+    lock_guard<mutex> lock(m);
+    if (items.empty()) return false;
+    value = move(items.front());
+    items.pop_front();
+    return true;
+  }
+
+  size_t size() {
+    lock_guard<mutex> lock(m);
+    return items.size();
+  }
+
+  deque<T> items;
+  mutex m;
+  condition_variable cv;
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Common.h"
+
+// Elo helpers for match results. Zuniq has no draws, so a match is a series
+// of Bernoulli trials with the score being the win ratio.
+
+inline double scoreFromElo(double elo) {
+  return 1.0 / (1.0 + pow(10.0, -elo / 400.0));
+}
+
+inline double eloFromScore(double score) {
+  // keep finite for 0% and 100% results
+  score = max(1e-3, min(1.0 - 1e-3, score));
+  return -400.0 * log10(1.0 / score - 1.0);
+}
+
+struct EloEstimate {
+  double elo;
+  double lower;
+  double upper;
+};
+
+// 95% confidence interval from the normal approximation of the score
+inline EloEstimate estimateElo(int wins, int games) {
+  if (games == 0) return {0.0, -OO, OO};
+  double score = static_cast<double>(wins) / games;
+  double margin = 1.96 * sqrt(max(score * (1.0 - score), 0.25 / games) / games);
+  return {eloFromScore(score), eloFromScore(score - margin),
+          eloFromScore(score + margin)};
+}
+
+inline ostream &operator<<(ostream &out, const EloEstimate &e) {
+  out << "elo=" << e.elo << " [" << e.lower << ", " << e.upper << "]";
+  return out;
+}
+
+// Sequential probability ratio test of H0: elo = elo0 against H1: elo = elo1
+// with error rates alpha (accepting H1 wrongly) and beta (accepting H0
+// wrongly). The log-likelihood ratio is checked after every result, so a
+// clear match stops early.
+struct Sprt {
+  enum Decision { Continue, AcceptH0, AcceptH1 };
+
+  Sprt(double elo0, double elo1, double alpha = 0.05, double beta = 0.05)
+      : p0(scoreFromElo(elo0)),
+        p1(scoreFromElo(elo1)),
+        lower(log(beta / (1.0 - alpha))),
+        upper(log((1.0 - beta) / alpha)) {}
+
+  double llr(int wins, int losses) const {
+    return wins * log(p1 / p0) + losses * log((1.0 - p1) / (1.0 - p0));
+  }
+
+  Decision decide(int wins, int losses) const {
+    auto ratio = llr(wins, losses);
+    if (ratio >= upper) return AcceptH1;
+    if (ratio <= lower) return AcceptH0;
+    return Continue;
+  }
+
+  double p0;
+  double p1;
+  double lower;
+  double upper;
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstring>
+
+#include "Common.h"
+
+// Fixed-size cache of network evaluations shared by every agent (and thread)
+// using the same weights. Keys are canonical states so the 8 symmetric images
+// of a position share one slot.
+//
+// Slots are lock-free: the key is stored xor-ed with the payload, so a slot
+// torn by two concurrent writers no longer matches its key and reads as a miss
+// instead of returning somebody else's value.
+//
+// Hits and misses are shared counters every lookup would write, so they are
+// only kept when built with ZUNIQ_WITH_STATS, like SearchStats.
+struct EvalCache {
+  static constexpr int defaultLog2Size = 20;
+#ifdef ZUNIQ_WITH_STATS
+  static constexpr bool countStats = true;
+#else
+  static constexpr bool countStats = false;
+#endif
+
+  explicit EvalCache(int log2Size = defaultLog2Size)
+      : shift(64 - log2Size), slots(1ull << log2Size), hits(0), misses(0) {}
+
+  bool find(State key, float &value) {
+    const auto &slot = slots[index(key)];
+    auto data = slot.data.load(memory_order_relaxed);
+    auto check = slot.check.load(memory_order_relaxed);
+    if ((data & validFlag) && (check ^ data) == key) {
+      uint32_t bits = static_cast<uint32_t>(data);
+      memcpy(&value, &bits, sizeof(value));
+      if constexpr (countStats) hits.fetch_add(1, memory_order_relaxed);
+      return true;
+    }
+    if constexpr (countStats) misses.fetch_add(1, memory_order_relaxed);
+    return false;
+  }
+
+  void store(State key, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint64_t data = validFlag | bits;
+    auto &slot = slots[index(key)];
+    slot.data.store(data, memory_order_relaxed);
+    slot.check.store(key ^ data, memory_order_relaxed);
+  }
+
+  void resetStats() {
+    hits = 0;
+    misses = 0;
+  }
+
+  double hitRate() const {
+    double h = hits.load(memory_order_relaxed);
+    double total = h + misses.load(memory_order_relaxed);
+    return total > 0.0 ? h / total : 0.0;
+  }
+
+  size_t index(State key) const {
+    return (key * 0x9E3779B97F4A7C15ull) >> shift;
+  }
+
+  struct Slot {
+    atomic<uint64_t> check{0};
+    atomic<uint64_t> data{0};
+  };
+
+  static constexpr uint64_t validFlag = 1ull << 32;
+
+  const int shift;
+  vector<Slot> slots;
+  atomic<uint64_t> hits;
+  atomic<uint64_t> misses;
+};
+
+inline ostream &operator<<(ostream &out, const EvalCache &cache) {
+  if (!EvalCache::countStats) return out << "cache-hits=off";
+  out << "cache-hits=" << 100.0 * cache.hitRate() << "% ("
+      << cache.hits.load() << "/" << cache.hits.load() + cache.misses.load()
+      << ")";
+  return out;
+}
@@ -0,0 +1,212 @@
+#include "ExampleStore.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+
+#ifdef ZUNIQ_WITH_ZLIB
+#include <zlib.h>
+#endif
+
+namespace {
+
+constexpr char magic[4] = {'Z', 'Q', 'E', 'X'};
+constexpr uint32_t version = 1;
+constexpr uint32_t compressedFlag = 1;
+constexpr uint32_t recordSize = sizeof(State) + sizeof(int16_t);
+
+void encode(const Example &example, char *record) {
+  int16_t value = static_cast<int16_t>(
+      lrintf(32767.0f * max(-1.0f, min(1.0f, example.value))));
+  memcpy(record, &example.state, sizeof(State));
+  memcpy(record + sizeof(State), &value, sizeof(value));
+}
+
+Example decode(const char *record) {
+  Example example;
+  int16_t value;
+  memcpy(&example.state, record, sizeof(State));
+  memcpy(&value, record + sizeof(State), sizeof(value));
+  example.value = value / 32767.0f;
+  return example;
+}
+
+}  // namespace
+
+ExampleWriter::ExampleWriter(const string &filename, bool compress,
+                             uint32_t chunkSize)
+    : file(fopen(filename.c_str(), "wb")),
+      header{{magic[0], magic[1], magic[2], magic[3]},
+             version,
+             compress && compressionAvailable() ? compressedFlag : 0,
+             recordSize,
+             0,
+             chunkSize,
+             0},
+      chunkCount(0),
+      ok(file != nullptr) {
+  if (!ok) {
+    cerr << "Cannot write " << filename << endl;
+    return;
+  }
+  if (compress && !compressionAvailable()) {
+    cerr << "Built without zlib, writing uncompressed examples" << endl;
+  }
+  chunk.resize(static_cast<size_t>(chunkSize) * recordSize);
+  ok = fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+bool ExampleWriter::compressionAvailable() {
+#ifdef ZUNIQ_WITH_ZLIB
+  return true;
+#else
+  return false;
+#endif
+}
+
+void ExampleWriter::write(const Example &example) {
+  if (!file) return;
+  encode(example, &chunk[chunkCount * recordSize]);
+  ++header.count;
+  if (++chunkCount == header.chunkSize) flushChunk();
+}
+
+void ExampleWriter::flushChunk() {
+  if (chunkCount == 0) return;
+  const size_t bytes = chunkCount * recordSize;
+#ifdef ZUNIQ_WITH_ZLIB
+  if (header.flags & compressedFlag) {
+    vector<char> compressed(compressBound(bytes));
+    uLongf compressedBytes = compressed.size();
+    ok = ok && compress2(reinterpret_cast<Bytef *>(compressed.data()),
+                         &compressedBytes,
+                         reinterpret_cast<const Bytef *>(chunk.data()), bytes,
+                         Z_BEST_SPEED) == Z_OK;
+    uint32_t chunkHeader[2] = {chunkCount,
+                               static_cast<uint32_t>(compressedBytes)};
+    ok = ok && fwrite(chunkHeader, sizeof(chunkHeader), 1, file) == 1;
+    ok = ok && fwrite(compressed.data(), compressedBytes, 1, file) == 1;
+    chunkCount = 0;
+    return;
+  }
+#endif
+  ok = ok && fwrite(chunk.data(), bytes, 1, file) == 1;
+  chunkCount = 0;
+}
+
+bool ExampleWriter::close() {
+  if (!file) return ok;
+  flushChunk();
+  // the count is only known now
+  ok = ok && fseek(file, 0, SEEK_SET) == 0 &&
+       fwrite(&header, sizeof(header), 1, file) == 1;
+  ok = fclose(file) == 0 && ok;
+  file = nullptr;
+  return ok;
+}
+
+ExampleReader::ExampleReader(const string &filename)
+    : header{}, data(nullptr), length(0), offset(sizeof(header)), remaining(0) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return;
+
+  struct stat info;
+  if (fstat(fd, &info) == 0 && info.st_size >= (off_t)sizeof(header)) {
+    length = info.st_size;
+    void *mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped != MAP_FAILED) {
+      madvise(mapped, length, MADV_SEQUENTIAL);
+      data = static_cast<const char *>(mapped);
+    }
+  }
+  ::close(fd);
+  if (!data) return;
+
+  memcpy(&header, data, sizeof(header));
+  bool valid = equal(magic, magic + 4, header.magic) &&
+               header.version == version && header.recordSize == recordSize &&
+               header.chunkSize > 0;
+  if (valid && !(header.flags & compressedFlag)) {
+    valid = length >= sizeof(header) + header.count * recordSize;
+  }
+#ifndef ZUNIQ_WITH_ZLIB
+  if (valid && (header.flags & compressedFlag)) {
+    cerr << "Built without zlib, cannot read " << filename << endl;
+    valid = false;
+  }
+#endif
+  if (!valid) {
+    cerr << "Not a supported example file: " << filename << endl;
+    munmap(const_cast<char *>(data), length);
+    data = nullptr;
+    return;
+  }
+  remaining = header.count;
+}
+
+ExampleReader::~ExampleReader() {
+  if (data) munmap(const_cast<char *>(data), length);
+}
+
+bool ExampleReader::next(vector<Example> &examples) {
+  examples.clear();
+  if (!data || remaining == 0) return false;
+
+  const char *records = data + offset;
+  uint64_t count = min<uint64_t>(remaining, header.chunkSize);
+#ifdef ZUNIQ_WITH_ZLIB
+  if (header.flags & compressedFlag) {
+    uint32_t chunkHeader[2];
+    if (offset + sizeof(chunkHeader) > length) return false;
+    memcpy(chunkHeader, records, sizeof(chunkHeader));
+    offset += sizeof(chunkHeader);
+    if (offset + chunkHeader[1] > length) return false;
+
+    count = chunkHeader[0];
+    buffer.resize(count * recordSize);
+    uLongf bytes = buffer.size();
+    if (uncompress(reinterpret_cast<Bytef *>(buffer.data()), &bytes,
+                   reinterpret_cast<const Bytef *>(data + offset),
+                   chunkHeader[1]) != Z_OK ||
+        bytes != buffer.size()) {
+      cerr << "Corrupted example chunk" << endl;
+      remaining = 0;
+      return false;
+    }
+    offset += chunkHeader[1];
+    records = buffer.data();
+  } else {
+    offset += count * recordSize;
+  }
+#else
+  offset += count * recordSize;
+#endif
+
+  examples.reserve(count);
+  for (uint64_t i = 0; i < count; ++i) {
+    examples.push_back(decode(records + i * recordSize));
+  }
+  remaining -= min(remaining, count);
+  return true;
+}
+
+bool convertExamples(const string &textFilename, const string &binaryFilename,
+                     bool compress) {
+  ifstream in(textFilename);
+  if (!in) {
+    cerr << "Cannot read " << textFilename << endl;
+    return false;
+  }
+  ExampleWriter writer(binaryFilename, compress);
+  for (Example example; in >> example;) {
+    writer.write(example);
+  }
+  auto count = writer.header.count;
+  if (!writer.close()) return false;
+  cout << "Converted " << count << " examples" << endl;
+  return true;
+}
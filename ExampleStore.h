@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdio>
+
+#include "Common.h"
+#include "NNAgent.h"
+
+// Binary example file, version 1 (little-endian):
+//
+//   header  magic "ZQEX", version, flags, record size, examples count,
+//           examples per chunk (32 bytes, see ExampleFileHeader)
+//   records 10 bytes each: the 8-byte state followed by the value quantized
+//           to int16 (value * 32767)
+//
+// Without compression the records directly follow the header, so the file
+// can be mmapped and read in place. With the compressed flag they are split
+// into chunks, each a {examples, bytes} pair of uint32 followed by the
+// deflated records of that chunk. Readers always hand out one chunk at a
+// time so memory stays bounded whatever the file size.
+
+struct ExampleFileHeader {
+  char magic[4];
+  uint32_t version;
+  uint32_t flags;
+  uint32_t recordSize;
+  uint64_t count;
+  uint32_t chunkSize;
+  uint32_t reserved;
+};
+
+static_assert(sizeof(ExampleFileHeader) == 32, "header layout is on disk");
+
+struct ExampleWriter {
+  static constexpr uint32_t defaultChunkSize = 1 << 16;
+
+  ExampleWriter(const string &filename, bool compress,
+                uint32_t chunkSize = defaultChunkSize);
+  ~ExampleWriter() { close(); }
+
+  void write(const Example &example);
+  bool close();
+
+  static bool compressionAvailable();
+
+  FILE *file;
+  ExampleFileHeader header;
+  vector<char> chunk;
+  uint32_t chunkCount;
+  bool ok;
+
+  void flushChunk();
+};
+
+struct ExampleReader {
+  explicit ExampleReader(const string &filename);
+  ~ExampleReader();
+
+  bool isOpen() const { return data != nullptr; }
+  uint64_t size() const { return header.count; }
+
+  // replaces `examples` with the next chunk, false once everything was read
+  bool next(vector<Example> &examples);
+
+  ExampleFileHeader header;
+  const char *data;
+  size_t length;
+  size_t offset;
+  uint64_t remaining;
+  vector<char> buffer;
+};
+
+bool convertExamples(const string &textFilename, const string &binaryFilename,
+                     bool compress);
@@ -0,0 +1,102 @@
+#include <stdexcept>
+#include <thread>
+
+#include "Common.h"
+#include "ConcurrentIndex.h"
+
+// Checks of the lock-free ConcurrentIndex, run by ctest. Exits with 1 and a
+// message on the first failure.
+//
+// usage: index_test [--seed S] [--threads N]
+
+int failures = 0;
+
+void fail(const string &message) {
+  cerr << "index_test: " << message << endl;
+  ++failures;
+}
+
+// every thread inserts every key, starting at a different one; each key
+// must be claimed once and all threads must agree on its slot
+void checkConcurrentInserts(uint64_t seed, int threads) {
+  constexpr int log2Size = 21;
+  constexpr size_t keysCount = 1 << 19;
+  mt19937_64 engine(seed);
+  vector<State> keys(keysCount);
+  for (auto &key : keys) key = engine() >> 4;
+  sort(keys.begin(), keys.end());
+  keys.erase(unique(keys.begin(), keys.end()), keys.end());
+  shuffle(keys.begin(), keys.end(), engine);
+
+  ConcurrentIndex index(log2Size);
+  vector<atomic<int>> claims(index.capacity());
+  vector<atomic<uint32_t>> slots(keys.size());
+  for (auto &slot : slots) slot = ConcurrentIndex::notFound;
+
+  const size_t n = keys.size();
+  vector<thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.emplace_back([&, t] {
+      for (size_t i = 0; i < n; ++i) {
+        size_t k = (i + t * n / threads) % n;
+        auto [slot, inserted] = index.insert(keys[k]);
+        if (slot == ConcurrentIndex::notFound) continue;
+        if (inserted) ++claims[slot];
+        auto expected = ConcurrentIndex::notFound;
+        if (!slots[k].compare_exchange_strong(expected, slot) &&
+            expected != slot) {
+          claims[slot] = -1;
+        }
+      }
+    });
+  }
+  for (auto &worker : workers) worker.join();
+
+  size_t claimed = 0;
+  for (size_t k = 0; k < n; ++k) {
+    auto slot = slots[k].load();
+    if (slot == ConcurrentIndex::notFound) continue;
+    ++claimed;
+    if (claims[slot] != 1 || index.find(keys[k]) != slot) {
+      fail("key " + to_string(keys[k]) + " has slot " + to_string(slot) +
+           " claimed " + to_string(claims[slot]) + " times");
+      return;
+    }
+  }
+  if (claimed != index.size()) {
+    fail(to_string(index.size()) + " slots taken for " + to_string(claimed) +
+         " keys");
+  }
+}
+
+// sizes whose slot numbers or hash shift do not fit are refused
+void checkSizes() {
+  for (int log2Size : {-1, 0, ConcurrentIndex::maxLog2Size + 1, 64}) {
+    try {
+      ConcurrentIndex index(log2Size);
+      fail("log2Size " + to_string(log2Size) + " accepted");
+    } catch (const invalid_argument &) {
+    }
+  }
+  ConcurrentIndex index(1);
+  if (index.capacity() != 2) fail("log2Size 1 gives no 2 slots");
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t seed = 12345;
+  int threads = 8;
+  for (int i = 1; i + 1 < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--seed") {
+      seed = stoull(argv[++i]);
+    } else if (arg == "--threads") {
+      threads = max(2, stoi(argv[++i]));
+    }
+  }
+
+  checkSizes();
+  checkConcurrentInserts(seed, threads);
+  if (failures) return 1;
+  cerr << "index_test: ok" << endl;
+  return 0;
+}
@@ -0,0 +1,72 @@
+#include "Common.h"
+#include "KnowledgeStore.h"
+
+// Offline tool for the knowledge stores players load with --knowledge and
+// write with --learn.
+//
+// usage: knowledge merge out.zks [--min-visits N] in.zks...
+//        knowledge dump in.zks [limit]
+
+const char *statusName(unsigned int status) {
+  return status == WIN ? "win" : status == LOSS ? "loss" : "unknown";
+}
+
+int merge(int argc, char *argv[]) {
+  string out = argv[2];
+  uint32_t minVisits = 0;
+  KnowledgeBuilder builder;
+  for (int i = 3; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--min-visits" && i + 1 < argc) {
+      minVisits = stoul(argv[++i]);
+      continue;
+    }
+    KnowledgeStore store;
+    if (!store.load(arg)) return 1;
+    builder.merge(store, minVisits);
+    cerr << arg << ": " << store.entriesCount << " nodes, "
+         << builder.nodes.size() << " merged" << endl;
+  }
+  if (!builder.save(out)) return 1;
+  cerr << "wrote " << builder.nodes.size() << " nodes to " << out << endl;
+  return 0;
+}
+
+int dump(int argc, char *argv[]) {
+  KnowledgeStore store;
+  if (!store.load(argv[2])) return 1;
+  uint64_t limit = argc > 3 ? stoull(argv[3]) : store.entriesCount;
+
+  uint64_t proven[4] = {};
+  for (uint64_t i = 0; i < store.entriesCount; ++i) {
+    ++proven[store.entries[i].status];
+  }
+  cout << store.entriesCount << " nodes, " << proven[WIN] << " won, "
+       << proven[LOSS] << " lost" << endl;
+
+  cout << fixed << setprecision(3);
+  for (uint64_t i = 0; i < min(limit, store.entriesCount); ++i) {
+    const auto &entry = store.entries[i];
+    cout << "0x" << hex << setw(16) << setfill('0') << entry.key << dec
+         << setfill(' ') << " " << statusName(entry.status)
+         << " visits=" << entry.visits;
+    const auto *actions = store.getActions(entry);
+    for (int a = 0; a < entry.actionsCount; ++a) {
+      const auto &action = actions[a];
+      cout << " " << showWall(action.wall) << action.q1;
+      if (action.status == WIN || action.status == LOSS) {
+        cout << statusName(action.status);
+      }
+    }
+    cout << endl;
+  }
+  return 0;
+}
+
+int main(int argc, char *argv[]) {
+  if (argc >= 3 && argv[1] == string("merge")) return merge(argc, argv);
+  if (argc >= 3 && argv[1] == string("dump")) return dump(argc, argv);
+  cerr << "usage: knowledge merge out.zks [--min-visits N] in.zks..." << endl;
+  cerr << "       knowledge dump in.zks [limit]" << endl;
+  return 1;
+}
@@ -0,0 +1,136 @@
+#include "KnowledgeStore.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+constexpr char knowledgeMagic[4] = {'Z', 'K', 'S', '1'};
+constexpr uint32_t knowledgeVersion = 1;
+
+KnowledgeStore::~KnowledgeStore() {
+  if (data) munmap(data, length);
+}
+
+bool KnowledgeStore::load(const string &filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    cerr << "cannot open " << filename << endl;
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<size_t>(st.st_size) < sizeof(KnowledgeHeader)) {
+    cerr << filename << " is not a knowledge store" << endl;
+    close(fd);
+    return false;
+  }
+  length = st.st_size;
+  data = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    data = nullptr;
+    cerr << "cannot map " << filename << endl;
+    return false;
+  }
+
+  const auto &header = *static_cast<const KnowledgeHeader *>(data);
+  auto expected = sizeof(KnowledgeHeader) +
+                  header.entriesCount * sizeof(KnowledgeEntry) +
+                  header.actionsCount * sizeof(KnowledgeAction);
+  if (memcmp(header.magic, knowledgeMagic, 4) != 0 ||
+      header.version != knowledgeVersion || expected != length) {
+    cerr << filename << " is not a knowledge store of version "
+         << knowledgeVersion << endl;
+    return false;
+  }
+  auto bytes = static_cast<const char *>(data);
+  entries = reinterpret_cast<const KnowledgeEntry *>(
+      bytes + sizeof(KnowledgeHeader));
+  entriesCount = header.entriesCount;
+  actions = reinterpret_cast<const KnowledgeAction *>(entries + entriesCount);
+  return true;
+}
+
+void KnowledgeBuilder::merge(State key, const Node &node) {
+  auto [it, inserted] = nodes.try_emplace(key, node);
+  if (inserted) return;
+  auto &known = it->second;
+  if (known.status == UNKNOWN) known.status = node.status;
+  known.visits += node.visits;
+
+  vector<KnowledgeAction> actions;
+  auto a = known.actions.cbegin();
+  auto b = node.actions.cbegin();
+  while (a != known.actions.end() || b != node.actions.end()) {
+    if (b == node.actions.end() ||
+        (a != known.actions.end() && a->wall < b->wall)) {
+      actions.push_back(*a++);
+    } else if (a == known.actions.end() || b->wall < a->wall) {
+      actions.push_back(*b++);
+    } else {
+      auto action = *a++;
+      if (action.status == UNKNOWN) action.status = b->status;
+      action.q1 += b->q1;
+      action.q2 += b->q2;
+      action.q3 += b->q3;
+      actions.push_back(action);
+      ++b;
+    }
+  }
+  known.actions = move(actions);
+}
+
+void KnowledgeBuilder::merge(const KnowledgeStore &store, uint32_t minVisits) {
+  for (uint64_t i = 0; i < store.entriesCount; ++i) {
+    const auto &entry = store.entries[i];
+    if (entry.visits < minVisits) continue;
+    Node node;
+    node.status = entry.status;
+    node.visits = entry.visits;
+    const auto *actions = store.getActions(entry);
+    node.actions.assign(actions, actions + entry.actionsCount);
+    // stores written before the bytes were reserved may hold garbage there
+    for (auto &action : node.actions) memset(action.reserved, 0, 2);
+    merge(entry.key, node);
+  }
+}
+
+bool KnowledgeBuilder::save(const string &filename) const {
+  vector<KnowledgeEntry> entries;
+  vector<KnowledgeAction> actions;
+  entries.reserve(nodes.size());
+  for (const auto &[key, node] : nodes) {
+    entries.push_back({key, static_cast<uint32_t>(actions.size()),
+                       node.visits, static_cast<uint8_t>(node.actions.size()),
+                       static_cast<uint8_t>(node.status),
+                       {}});
+    actions.insert(actions.end(), node.actions.begin(), node.actions.end());
+  }
+
+  KnowledgeHeader header{};
+  memcpy(header.magic, knowledgeMagic, 4);
+  header.version = knowledgeVersion;
+  header.entriesCount = entries.size();
+  header.actionsCount = actions.size();
+
+  // written aside and renamed, players may have the old file mapped
+  auto tmp = filename + ".tmp";
+  {
+    ofstream out(tmp, ios::binary);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char *>(entries.data()),
+              entries.size() * sizeof(KnowledgeEntry));
+    out.write(reinterpret_cast<const char *>(actions.data()),
+              actions.size() * sizeof(KnowledgeAction));
+    if (!out) {
+      cerr << "cannot write " << tmp << endl;
+      return false;
+    }
+  }
+  return rename(tmp.c_str(), filename.c_str()) == 0;
+}
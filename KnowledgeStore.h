@@ -0,0 +1,104 @@
+#pragma once
+
+#include <map>
+#include <type_traits>
+
+#include "Common.h"
+
+// Search statistics and proven results kept across games. Nodes are keyed by
+// the canonical orientation of their state, the smallest of its 8 symmetric
+// images, and their actions are stored in that orientation. A store file is
+// a header, the entries sorted by key and then their actions, so a player
+// maps it read-only and searches it in place. Files are in native byte order.
+
+// Records have no implicit padding, the reserved bytes are zero so that the
+// same knowledge always gives the same file.
+struct KnowledgeAction {
+  uint8_t wall;
+  uint8_t status;
+  uint8_t reserved[2];
+  Stats q1;
+  Stats q2;
+  Stats q3;
+};
+
+struct KnowledgeEntry {
+  State key;
+  uint32_t firstAction;
+  uint32_t visits;
+  uint8_t actionsCount;
+  uint8_t status;
+  uint8_t reserved[6];
+};
+
+struct KnowledgeHeader {
+  char magic[4];
+  uint32_t version;
+  uint64_t entriesCount;
+  uint64_t actionsCount;
+};
+
+static_assert(is_trivially_copyable_v<KnowledgeAction> &&
+              is_trivially_copyable_v<KnowledgeEntry>);
+static_assert(sizeof(KnowledgeAction) == 4 + 3 * sizeof(Stats) &&
+              sizeof(KnowledgeEntry) == 24 && sizeof(KnowledgeHeader) == 24);
+
+// the smallest image of state, transformation is the one giving it
+inline State canonicalize(State state, int &transformation) {
+  State images[8] = {};
+  for (auto s = state; s; s &= s - 1) {
+    int w = __builtin_ctzll(s);
+    for (int t = 0; t < 8; ++t) add(images[t], transformations[t][w]);
+  }
+  transformation = static_cast<int>(min_element(images, images + 8) - images);
+  return images[transformation];
+}
+
+struct KnowledgeStore {
+  KnowledgeStore() = default;
+  KnowledgeStore(const KnowledgeStore &) = delete;
+  KnowledgeStore &operator=(const KnowledgeStore &) = delete;
+  ~KnowledgeStore();
+
+  bool load(const string &filename);
+
+  const KnowledgeEntry *find(State key) const {
+    auto end = entries + entriesCount;
+    auto it = lower_bound(
+        entries, end, key,
+        [](const KnowledgeEntry &e, State key) { return e.key < key; });
+    return it != end && it->key == key ? it : nullptr;
+  }
+
+  const KnowledgeAction *getActions(const KnowledgeEntry &entry) const {
+    return actions + entry.firstAction;
+  }
+
+  void *data = nullptr;
+  size_t length = 0;
+  const KnowledgeEntry *entries = nullptr;
+  uint64_t entriesCount = 0;
+  const KnowledgeAction *actions = nullptr;
+};
+
+// In-memory nodes on their way to a store file: what a game learned, or the
+// merge of several files.
+struct KnowledgeBuilder {
+  struct Node {
+    unsigned int status = UNKNOWN;
+    uint32_t visits = 0;
+    // sorted by wall
+    vector<KnowledgeAction> actions;
+  };
+
+  // replaces what is known about key
+  void set(State key, const Node &node) { nodes[key] = node; }
+  // adds the statistics of node to what is known about key, a proof wins
+  // over statistics
+  void merge(State key, const Node &node);
+  // merges the nodes of store with at least minVisits visits
+  void merge(const KnowledgeStore &store, uint32_t minVisits = 0);
+  bool save(const string &filename) const;
+
+  map<State, Node> nodes;
+};
@@ -1,23 +1,35 @@
 #include "McRaveAgent.h"
 
-RNG StateInfo::rng;
+thread_local RNG StateInfo::rng;
 
-// 100 millisconds for maximum reading/writing overhead
-McRaveAgent::McRaveAgent() { totalTime = 0.1; }
+McRaveAgent::McRaveAgent() {}
 
 void McRaveAgent::simulate(const Position &pos) {
   auto tmpPos = pos;
   IterationResult result;
   result.firstStateBlack = pos.turns & 1;
+  timers.setTurn(pos.turns);
+  if (m.size() >= static_cast<size_t>(maxNodes)) evict(pos);
   int r = simulateTree(tmpPos, result);
+  SearchStats::add(stats.iterations);
+  SearchStats::add(stats.descentDepth, result.countTransitions);
   if (r == 0) {
     result.value = tmpPos.turns & 1 ? OO : -OO;
   } else if (r <= 5) {
-    int winningAction = getWinningAction(tmpPos);
+    SearchStats::add(stats.solverCalls);
+    int winningAction;
+    {
+      ScopedTimer timer(timers, Phase::GetWinningAction);
+      winningAction = getWinningAction(tmpPos);
+    }
     if (winningAction == -1) {
       result.value = tmpPos.turns & 1 ? OO : -OO;
     } else {
-      result.add(&m[tmpPos.state], winningAction);
+      auto &stateInfo = m[tmpPos.state];
+      // the node may be new here, it needs the zone to be descended
+      stateInfo.actionInfo[winningAction].zoneSquares =
+          tmpPos.findZone(winningAction).squares;
+      result.add(&stateInfo, winningAction);
       result.value = tmpPos.turns & 1 ? -OO : OO;
     }
   } else {
@@ -39,80 +51,179 @@ int McRaveAgent::getWinningAction(const Position &pos) {
 
 void McRaveAgent::simulateDefault(const Position &pos,
                                   IterationResult &result) {
+  ScopedTimer timer(timers, Phase::SimulateDefault);
   result.value = 0.0f;
-  for (int s = 0; s < samples; ++s) {
+  result.samples = 0;
+  if (valueNetwork && networkSamples > 0) {
+    auto value = estimate(pos.state);
+    result.value += networkSamples * (pos.turns & 1 ? -value : value);
+    result.samples += networkSamples;
+    SearchStats::add(stats.networkSamples, networkSamples);
+  }
+  const int firstPlayout = result.samples;
+
+  // the playouts run whatever the results are go through the batch
+  int minSamples = min(sampling.minSamples, sampling.maxSamples);
+  int mandatory = min(minSamples - result.samples, PlayoutBatch::lanes);
+  if (batchedPlayouts && playoutSolverThreshold == 0 && mandatory > 0) {
+    playouts.run(pos, gen, mandatory);
+    for (int i = 0; i < mandatory; ++i) {
+      addPlayout(result, playouts.actions[i], playouts.length[i],
+                 playouts.value[i]);
+    }
+  }
+
+  while (!sampling.shouldStop(result.samples, result.value)) {
     int len = 0;
     pair<bool, int> actions[60];
     auto tmpPos = pos;
+    bool solve = false;
     for (Move move; tmpPos.getRandomMove(gen, move);) {
+      if (tmpPos.wallsLength <= playoutSolverThreshold) {
+        solve = true;
+        break;
+      }
       actions[len++] = {tmpPos.turns & 1, move.wall};
       tmpPos.doMove(move);
     }
     auto value = tmpPos.turns & 1 ? 1.0f : -1.0f;
-    result.value += value;
-    for (int i = 0; i < len; ++i) {
-      auto [black, action] = actions[i];
-      auto &amafStats = result.amafStats[action];
-      if (black) {
-        amafStats.black.update(value);
-      } else {
-        amafStats.white.update(value);
+    if (solve) {
+      SearchStats::add(stats.playoutSolverCalls);
+      // the player to move wins exactly when it has a winning action
+      int winningAction = getWinningAction(tmpPos);
+      if (winningAction != -1) {
+        actions[len++] = {tmpPos.turns & 1, winningAction};
+        value = -value;
       }
-      amafStats.any.update(value);
     }
+    addPlayout(result, actions, len, value);
   }
+  SearchStats::add(stats.playouts, result.samples - firstPlayout);
+
+  result.value /= result.samples;
+}
 
-  result.value /= samples;
+void McRaveAgent::addPlayout(IterationResult &result,
+                             const pair<bool, int> *actions, int len,
+                             float value) {
+  result.value += value;
+  ++result.samples;
+  for (int i = 0; i < len; ++i) {
+    auto [black, action] = actions[i];
+    auto &amafStats = result.amafStats[action];
+    if (black) {
+      amafStats.black.update(value);
+    } else {
+      amafStats.white.update(value);
+    }
+    amafStats.any.update(value);
+  }
 }
 
 int McRaveAgent::getDepth(const Position &pos) {
   int depth = 0;
   auto tmpPos = pos;
-  while (!tmpPos.isEndGame()) {
-    auto state = tmpPos.state;
-    if (!contains(state)) break;
-    const auto &stateInfo = m[state];
+  for (auto node = m.find(tmpPos.state); node;
+       node = m.find(tmpPos.state)) {
+    const auto &stateInfo = *node;
     if (stateInfo.isLosing() || stateInfo.isWinning()) return 1000;
     int next = stateInfo.selectMostVisited();
     if (stateInfo.actionInfo[next].isLosing()) {
       next = stateInfo.select();
     }
-    auto move = tmpPos.getMove(next);
     ++depth;
-    tmpPos.doMove(move);
+    tmpPos.doMove(stateInfo.getMove(next));
   }
   return depth;
 }
 
-int McRaveAgent::simulateTree(Position &pos, IterationResult &result,
-                              StateInfo *lastState, ActionInfo *lastAction) {
-  if (pos.isEndGame()) return 0;
-
-  auto state = pos.state;
-  if (!contains(state)) {
-    if (m.size() < 120000) {
-      auto &newState = newNode(pos);
-      Move move;
-      pos.getRandomMove(gen, move);
-      auto action = move.wall;
-      pos.doMove(move);
-      result.add(&newState, action);
-      return newState.actionsCount;
+// Walks down the tree with one hash lookup per level, the path goes to
+// result.transitions. Returns the number of actions of the leaf, 0 when the
+// game or the node is already decided.
+int McRaveAgent::simulateTree(Position &pos, IterationResult &result) {
+  ScopedTimer timer(timers, Phase::SimulateTree);
+  StateInfo *lastState = nullptr;
+  ActionInfo *lastAction = nullptr;
+  for (;;) {
+    // expanded nodes are never terminal, only a new leaf needs the check
+    auto node = m.find(pos.state);
+    if (!node) {
+      SearchStats::add(stats.treeMisses);
+      if (pos.isEndGame()) return 0;
+      if (m.size() < static_cast<size_t>(maxNodes)) {
+        SearchStats::add(stats.expansions);
+        auto &newState = newNode(pos);
+        Move move;
+        pos.getRandomMove(gen, move);
+        auto action = move.wall;
+        pos.doMove(move);
+        result.add(&newState, action);
+        return newState.actionsCount;
+      }
+      SearchStats::add(stats.droppedNodes);
+      return lastState ? lastState->actionsCount : 60;
+    }
+    SearchStats::add(stats.treeHits);
+
+    auto &stateInfo = *node;
+    if (lastAction != nullptr) {
+      lastAction->impact = lastState->actionsCount - stateInfo.actionsCount;
     }
-    return lastState ? lastState->actionsCount : 60;
+    if (stateInfo.isLosing()) return 0;
+    int action = selectAction(pos, stateInfo);
+    pos.doMove(stateInfo.getMove(action));
+    result.add(&stateInfo, action);
+    lastState = &stateInfo;
+    lastAction = &stateInfo.actionInfo[action];
   }
+}
 
-  auto &stateInfo = m[state];
-  if (lastAction != nullptr) {
-    lastAction->impact = lastState->actionsCount - stateInfo.actionsCount;
+// Makes room in a full tree by erasing the least visited tenth of its nodes,
+// except those on the principal variation from pos and the proven ones. The
+// least visited nodes are mostly leaves, but transpositions make the tree a
+// graph and a node can be visited more than one of its parents, which then
+// loses it and builds it again. Runs between iterations, no pointer into the
+// tree is held.
+void McRaveAgent::evict(const Position &pos) {
+  State principal[61];
+  int principalLength = 0;
+  auto tmpPos = pos;
+  for (auto node = m.find(tmpPos.state); node;
+       node = m.find(tmpPos.state)) {
+    principal[principalLength++] = tmpPos.state;
+    const auto &stateInfo = *node;
+    if (stateInfo.isLosing()) break;
+    int next = stateInfo.isWinning() ? stateInfo.winningAction
+                                     : stateInfo.selectMostVisited();
+    if (next < 0) break;
+    tmpPos.doMove(stateInfo.getMove(next));
   }
-  if (stateInfo.isLosing()) return 0;
-  auto move = select(pos);
-  auto &actionInfo = stateInfo.actionInfo[move.wall];
-  auto action = move.wall;
-  pos.doMove(move);
-  result.add(&stateInfo, action);
-  return simulateTree(pos, result, &stateInfo, &actionInfo);
+
+  // proofs cost whole subtrees to find again
+  const auto end = principal + principalLength;
+  auto evictable = [&](State state, const StateInfo &info) {
+    return info.status == UNKNOWN && find(principal, end, state) == end;
+  };
+  vector<unsigned int> visits;
+  visits.reserve(m.size());
+  m.forEach([&](State state, const StateInfo &info) {
+    if (evictable(state, info)) visits.push_back(info.visits);
+  });
+  if (visits.empty()) return;
+  const size_t count = max<size_t>(1, min(m.size() / 10, visits.size()));
+  nth_element(visits.begin(), visits.begin() + count - 1, visits.end());
+  const auto threshold = visits[count - 1];
+
+  size_t evicted = 0;
+  m.eraseIf([&](State state, const StateInfo &info) {
+    if (evicted == count || info.visits > threshold ||
+        !evictable(state, info)) {
+      return false;
+    }
+    ++evicted;
+    return true;
+  });
+  SearchStats::add(stats.evictedNodes, evicted);
 }
 
 float McRaveAgent::eval(const Position &pos, const Move &move) {
@@ -121,22 +232,25 @@ float McRaveAgent::eval(const Position &pos, const Move &move) {
 
 Move McRaveAgent::select(const Position &pos) {
   const auto &stateInfo = m[pos.state];
+  return stateInfo.getMove(selectAction(pos, stateInfo));
+}
+
+int McRaveAgent::selectAction(const Position &pos,
+                              const StateInfo &stateInfo) {
   if ((pos.turns & 1) != me) {
-    int a =
-        gen.lessThan(10) == 0 ? stateInfo.selectRandom() : stateInfo.select();
-    return pos.getMove(a);
+    return gen.lessThan(10) == 0 ? stateInfo.selectRandom()
+                                 : stateInfo.select();
   }
-
-  int a = stateInfo.select();
-  return pos.getMove(a);
+  return stateInfo.select();
 }
 
 Move McRaveAgent::selectMostVisited(const Position &pos) {
-  int mostVisited = m[pos.state].selectMostVisited();
-  return pos.getMove(mostVisited);
+  const auto &stateInfo = m[pos.state];
+  return stateInfo.getMove(stateInfo.selectMostVisited());
 }
 
 void McRaveAgent::backup(const IterationResult &result) {
+  ScopedTimer timer(timers, Phase::Backup);
   const int T = result.countTransitions;
   float value = result.value;
   int relevantActions[60], relevantActionsCount = 0;
@@ -149,6 +263,7 @@ void McRaveAgent::backup(const IterationResult &result) {
     bool black = t & 1 ? !result.firstStateBlack : result.firstStateBlack;
     float v = black ? -value : value;
     if (isExactWin(v)) {
+      if (!state->isWinning()) SearchStats::add(stats.provenWins);
       state->markWinning(at);
       continue;
     }
@@ -159,6 +274,7 @@ void McRaveAgent::backup(const IterationResult &result) {
                            return !info || info.isLosing();
                          });
       if (loss) {
+        if (!state->isLosing()) SearchStats::add(stats.provenLosses);
         state->markLosing();
         continue;
       } else {
@@ -167,13 +283,13 @@ void McRaveAgent::backup(const IterationResult &result) {
       }
     }
 
-    state->updateQ1(at, v, samples);
+    state->updateQ1(at, v, result.samples);
 
     bool samePlayer = true;
     for (int u = t; u < T; ++u) {
       int au = result.transitions[u].second;
-      state->updateQ3(au, v, samples);
-      if (samePlayer) state->updateQ2(au, v, samples);
+      state->updateQ3(au, v, result.samples);
+      if (samePlayer) state->updateQ2(au, v, result.samples);
       samePlayer = !samePlayer;
     }
 
@@ -193,8 +309,11 @@ void McRaveAgent::backup(const IterationResult &result) {
 }
 
 StateInfo &McRaveAgent::newNode(const Position &pos) {
+  ScopedTimer timer(timers, Phase::NewNode);
   auto &info = m[pos.state];
   info.invalid = (~pos.placed) & (~pos.possibleWalls);
+  int walls[60], count = 0;
+  State nextStates[60];
   for (const Move &move : pos) {
     info.actionsCount++;
 
@@ -203,11 +322,161 @@ StateInfo &McRaveAgent::newNode(const Position &pos) {
         goodOpeningMove[pos.turns & 1][w]) {
       info.actionInfo[w].status = UNKNOWN;
       info.actionInfo[w].impact = pos.getImpact(move);
+      info.actionInfo[w].zoneSquares = move.zone.squares;
+      if (valueNetwork && priorVisits > 0) {
+        walls[count] = w;
+        nextStates[count++] = pos.getStateAfterPlaying(move);
+      }
+    }
+  }
+
+  if (knowledge) seed(pos.state, info);
+
+  if (count > 0) {
+    float values[60];
+    valueNetwork->run(nextStates, count, values);
+    for (int i = 0; i < count; ++i) {
+      info.actionInfo[walls[i]].q1.update(-values[i], priorVisits);
     }
   }
   return info;
 }
 
+bool McRaveAgent::useValueNetwork(const string &filename) {
+  auto network = make_shared<QuantizedNetwork>();
+  if (!network->load(filename)) return false;
+  valueNetwork = move(network);
+  return true;
+}
+
+void McRaveAgent::reseed(unsigned int seed) {
+  gen.engine.seed(seed);
+  StateInfo::rng.engine.seed(seed ^ 0x9e3779b9u);
+}
+
+void McRaveAgent::useSettings(const SearchSettings &settings) {
+  if (&settings != this) SearchSettings::operator=(settings);
+  m.setPageMode(pageMode);
+  timers.enabled = phaseTimers;
+}
+
+bool McRaveAgent::useKnowledge(const string &filename) {
+  auto store = make_shared<KnowledgeStore>();
+  if (!store->load(filename)) return false;
+  knowledge = move(store);
+  return true;
+}
+
+void McRaveAgent::seed(State state, StateInfo &info) const {
+  int t;
+  const auto *entry = knowledge->find(canonicalize(state, t));
+  if (!entry) return;
+  const int *inv = transformations[inverse[t]];
+  auto capped = [this](Stats stats) {
+    stats.visits = min(stats.visits, knowledgeVisits);
+    return stats;
+  };
+  const auto *actions = knowledge->getActions(*entry);
+  for (int i = 0; i < entry->actionsCount; ++i) {
+    const auto &action = actions[i];
+    int a = inv[action.wall];
+    auto &actionInfo = info.actionInfo[a];
+    if (!actionInfo) continue;
+    if (action.status == WIN) info.markWinning(a);
+    if (action.status == LOSS) info.markLosing(a);
+    actionInfo.q1 += capped(action.q1);
+    actionInfo.q2 += capped(action.q2);
+    actionInfo.q3 += capped(action.q3);
+  }
+  bool loss = all_of(info.actionInfo, info.actionInfo + 60,
+                     [](const ActionInfo &a) { return !a || a.isLosing(); });
+  if (loss) info.markLosing();
+}
+
+void McRaveAgent::unseed(State state, StateInfo &info) const {
+  int t;
+  const auto *entry = knowledge ? knowledge->find(canonicalize(state, t))
+                                : nullptr;
+  if (entry) {
+    const int *inv = transformations[inverse[t]];
+    auto capped = [this](Stats stats) {
+      stats.visits = min(stats.visits, knowledgeVisits);
+      return stats;
+    };
+    const auto *actions = knowledge->getActions(*entry);
+    for (int i = 0; i < entry->actionsCount; ++i) {
+      const auto &action = actions[i];
+      auto &actionInfo = info.actionInfo[inv[action.wall]];
+      if (!actionInfo) continue;
+      actionInfo.q1.remove(capped(action.q1));
+      actionInfo.q2.remove(capped(action.q2));
+      actionInfo.q3.remove(capped(action.q3));
+    }
+  }
+
+  if (!valueNetwork || priorVisits == 0) return;
+  int walls[60], count = 0;
+  State nextStates[60];
+  for (int a = 0; a < 60; ++a) {
+    if (!info.actionInfo[a]) continue;
+    auto move = info.getMove(a);
+    auto next = state | getFlag(a);
+    if (move.zone) next = (next & ~move.zone.walls) | move.zone.border;
+    walls[count] = a;
+    nextStates[count++] = next;
+  }
+  float values[60];
+  if (count > 0) valueNetwork->run(nextStates, count, values);
+  for (int i = 0; i < count; ++i) {
+    info.actionInfo[walls[i]].q1.remove({-values[i], priorVisits});
+  }
+}
+
+// saves the well visited and the proven nodes of the tree in learned
+void McRaveAgent::learn() {
+  m.forEach([this](State state, const StateInfo &stateInfo) {
+    if (stateInfo.status == UNKNOWN && stateInfo.visits < learnMinVisits) {
+      return;
+    }
+    // the store would otherwise count its own statistics again at every
+    // merge, and the prior as playouts
+    auto info = stateInfo;
+    unseed(state, info);
+    int t;
+    auto key = canonicalize(state, t);
+    KnowledgeBuilder::Node node;
+    node.status = info.status;
+    node.visits = info.visits;
+    int valid = 0;
+    for (int a = 0; a < 60; ++a) {
+      const auto &action = info.actionInfo[a];
+      if (!action) continue;
+      ++valid;
+      node.actions.push_back({static_cast<uint8_t>(transformations[t][a]),
+                              static_cast<uint8_t>(action.status),
+                              {},
+                              action.q1,
+                              action.q2,
+                              action.q3});
+    }
+    sort(node.actions.begin(), node.actions.end(),
+         [](const auto &lhs, const auto &rhs) { return lhs.wall < rhs.wall; });
+    // opening moves left out of the node may not lose
+    if (node.status == LOSS && valid != info.actionsCount) {
+      node.status = UNKNOWN;
+    }
+    learned.set(key, node);
+  });
+}
+
+bool McRaveAgent::saveKnowledge() {
+  learn();
+  auto filename = learnPath + "." + to_string(getpid());
+  cerr << "saving " << learned.nodes.size() << " nodes to " << filename
+       << endl;
+  return learned.save(filename);
+}
+
 void McRaveAgent::log(const Position &pos, const Move &move) {
   const auto &info = m[pos.state].actionInfo[move.wall];
 
@@ -225,26 +494,42 @@ void McRaveAgent::log(const Position &pos, const Move &move) {
   cerr << "e=" << 50.0f * (1.0f + m[pos.state].eval(move.wall)) << "%" << endl;
 }
 
+void McRaveAgent::writeSearchRecord(const Position &pos, const Move &move,
+                                    const char *result, int iterations,
+                                    double dt) {
+  if (statsFd < 0) return;
+  const auto &info = m[pos.state].actionInfo[move.wall];
+  ostringstream out;
+  out << fixed << setprecision(4);
+  out << "{\"turn\": " << pos.turns + 1 << ", \"move\": \"" << move
+      << "\", \"result\": \"" << result << "\", \"iterations\": " << iterations
+      << ", \"time\": " << dt << ", \"totalTime\": " << clock.totalTime
+      << ", \"nodes\": " << m.size() << ", \"depth\": " << getDepth(pos)
+      << ", \"value\": " << info.q1.value << ", \"visits\": " << info.q1.visits;
+  if (SearchStats::enabled) {
+    out << ", \"stats\": ";
+    stats.writeJson(out);
+  }
+  out << "}";
+  writeRecord(statsFd, out.str());
+}
+
 pair<bool, Move> McRaveAgent::getBestMove(const Position &pos,
                                           bool useTimeConstraint) {
   cerr << fixed << setprecision(2);
   const auto start = getTimePoint();
   me = pos.turns & 1;
 
-  auto transformed = transformState(pos.placed);
-  if (auto it = openingBook.find(transformed); it != openingBook.end()) {
+  if (Move bookMove; book.find(pos, bookMove)) {
     cerr << "From opening book" << endl;
-    const int *inv = transformations[inverse[transformationIndex]];
-    return {false, {inv[it->second], {}}};
+    return {false, bookMove};
   }
 
-  auto maxTime = defaultMaxTime;
-  if (pos.turns >= 18) {
-    const double maxMoveTime = 2.75;
-    maxTime = min(maxMoveTime, (maxTotalTime - totalTime) / 2);
-  }
+  auto maxTime = clock.getMaxTime(pos.turns);
   cerr << "max-time=" << maxTime << endl;
 
+  stats.reset();
+  if (!learnPath.empty()) learn();
   clean(pos);
   int i = 0;
   for (; i < maxIterations; ++i) {
@@ -252,10 +537,11 @@ pair<bool, Move> McRaveAgent::getBestMove(const Position &pos,
     const auto &stateInfo = m[pos.state];
     if (stateInfo.isWinning()) {
       auto dt = getDeltaTimeSince(start);
-      totalTime += dt;
-      cerr << "i=" << i << " dt=" << dt << " tt=" << totalTime << endl;
+      clock.totalTime += dt;
+      cerr << "i=" << i << " dt=" << dt << " tt=" << clock.totalTime << endl;
       cerr << "=>Win found! turn=" << pos.turns + 1 << endl;
       const auto winningMove = pos.getMove(stateInfo.winningAction);
+      writeSearchRecord(pos, winningMove, "win", i, dt);
       bool claimWin = canClaimWin;
       canClaimWin = false;
       return {claimWin, winningMove};
@@ -263,20 +549,20 @@ pair<bool, Move> McRaveAgent::getBestMove(const Position &pos,
     if (stateInfo.isLosing()) {
       // in this case just choose the most visited
       auto dt = getDeltaTimeSince(start);
-      totalTime += dt;
-      cerr << "i=" << i << " dt=" << dt << " tt=" << totalTime << endl;
+      clock.totalTime += dt;
+      cerr << "i=" << i << " dt=" << dt << " tt=" << clock.totalTime << endl;
       cerr << "Game lost! Playing most visited anyway.." << endl;
-      return {false, selectMostVisited(pos)};
+      const auto move = selectMostVisited(pos);
+      writeSearchRecord(pos, move, "loss", i, dt);
+      return {false, move};
     }
 
     if (useTimeConstraint &&
-        getDeltaTimeSince(start) >= maxTime + maxCheckTime) {
+        clock.isTimeUp(getDeltaTimeSince(start), maxTime, [&] {
+          return select(pos) == selectMostVisited(pos);
+        })) {
       break;
     }
-
-    if (useTimeConstraint && getDeltaTimeSince(start) >= maxTime) {
-      if (select(pos) == selectMostVisited(pos)) break;
-    }
   }
 
   auto bestMove = selectMostVisited(pos);
@@ -290,11 +576,13 @@ pair<bool, Move> McRaveAgent::getBestMove(const Position &pos,
   log(pos, bestMove);
   auto dt = getDeltaTimeSince(start);
   auto depth = getDepth(pos);
-  totalTime += dt;
+  clock.totalTime += dt;
   auto speed = 0.001 * static_cast<double>(i) / dt;
   cerr << "i=" << (i + 500) / 1000 << "k d=" << depth << " dt=" << dt
-       << " tt=" << totalTime << " " << speed << "k it/s" << endl;
+       << " tt=" << clock.totalTime << " " << speed << "k it/s" << endl;
   cerr << "impact=" << info.impact << endl;
+  writeSearchRecord(pos, bestMove, "search", i, dt);
+  if (PhaseTimers::dumpRequested.exchange(false)) timers.dump(cerr);
   const float value = info.q1.value;
   bool claimWin = canClaimWin && pos.turns >= 18 && value >= 0.34f;
   if (claimWin) canClaimWin = false;
@@ -302,6 +590,44 @@ pair<bool, Move> McRaveAgent::getBestMove(const Position &pos,
   return {claimWin, bestMove};
 }
 
+Analysis McRaveAgent::analyze(const Position &pos, int iterations,
+                             double maxTime) {
+  const auto start = getTimePoint();
+  me = pos.turns & 1;
+  m.clear();
+  int i = 0;
+  while (i < iterations) {
+    simulate(pos);
+    ++i;
+    const auto &stateInfo = m[pos.state];
+    if (stateInfo.isWinning() || stateInfo.isLosing()) break;
+    if (maxTime > 0.0 && i % 256 == 0 && getDeltaTimeSince(start) >= maxTime) {
+      break;
+    }
+  }
+
+  const auto &stateInfo = m[pos.state];
+  Analysis analysis;
+  analysis.status = "unknown";
+  if (stateInfo.isWinning()) {
+    analysis.bestMove = pos.getMove(stateInfo.winningAction);
+    analysis.status = "win";
+  } else {
+    analysis.bestMove = selectMostVisited(pos);
+    if (stateInfo.actionInfo[analysis.bestMove.wall].isLosing()) {
+      analysis.bestMove = select(pos);
+    }
+    if (stateInfo.isLosing()) analysis.status = "loss";
+  }
+  const auto &info = stateInfo.actionInfo[analysis.bestMove.wall];
+  analysis.value = info.q1.value;
+  analysis.visits = info.q1.visits;
+  analysis.iterations = i;
+  analysis.time = getDeltaTimeSince(start);
+  analysis.depth = getDepth(pos);
+  return analysis;
+}
+
 void McRaveAgent::launchDebugSession(const Position &pos) {
   cerr << fixed << setprecision(3);
   int maxDebugIterations;
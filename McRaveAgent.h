@@ -1,18 +1,30 @@
 #pragma once
 
+#include <memory>
+
 #include "Common.h"
+#include "KnowledgeStore.h"
+#include "Network.h"
+#include "NodeArena.h"
+#include "OpeningBook.h"
+#include "PhaseTimers.h"
+#include "PlayoutBatch.h"
 #include "Position.h"
 #include "RNG.h"
-#include "robin_hood.h"
+#include "SearchStats.h"
+#include "TimeManager.h"
 
 struct ActionInfo {
-  ActionInfo() : status(INVALID) {}
+  ActionInfo() : status(INVALID), zoneSquares(0) {}
 
   Stats q1;
   Stats q2;
   Stats q3;
   unsigned int status : 2;
   unsigned int impact : 6;
+  // squares of the zone this action closes, saved at expansion so descending
+  // through the node does not run findZone again
+  unsigned int zoneSquares : 25;
 
   operator bool() const { return status != INVALID; }
   bool isWinning() const { return status == WIN; }
@@ -34,7 +46,8 @@ struct StateInfo {
   unsigned int actionsCount : 6;
   unsigned int visits : 18;
 
-  static RNG rng;
+  // one per thread so agents can search in parallel
+  static thread_local RNG rng;
 
   bool isWinning() const { return status == WIN; }
   bool isLosing() const { return status == LOSS; }
@@ -47,7 +60,7 @@ struct StateInfo {
   void markLosing() { status = LOSS; }
 
   float eval(int a) const {
-    const auto &[q1, q2, q3, status, impact] = actionInfo[a];
+    const auto &[q1, q2, q3, status, impact, squares] = actionInfo[a];
 
     if (status == WIN) return OO;
 
@@ -56,7 +69,11 @@ struct StateInfo {
     float bias = static_cast<float>(impact);
 
     if (q3.visits == 0) {
-      return 1000.0f * bias + rng.fromRange(0, 60);
+      // actions of equal impact are tried in the order of the network prior,
+      // the only statistics they have yet, or else at random
+      float order =
+          q1.visits ? 30.0f * (1.0f + q1.value) : rng.fromRange(0, 60);
+      return 1000.0f * bias + order;
     }
 
     auto [v1, v2, v3] = make_tuple(q1.value, q2.value, q3.value);
@@ -69,6 +86,11 @@ struct StateInfo {
     return value + bias * sqrtf(visits) / n;
   }
 
+  Move getMove(int a) const {
+    const auto squares = actionInfo[a].zoneSquares;
+    return {a, squares ? zoneOfSquares(squares) : Zone{}};
+  }
+
   int selectRandom() const {
     int actions[60];
     int len = 0;
@@ -130,6 +152,20 @@ struct StateInfo {
 
 constexpr int samples = 10;
 
+// Playouts run at a new leaf: at least minSamples, then stop as soon as the
+// results agree (|mean| >= stopMargin), and never more than maxSamples. The
+// default is the fixed count of 10.
+struct SamplingPolicy {
+  int minSamples = samples;
+  int maxSamples = samples;
+  float stopMargin = 1.0f;
+
+  bool shouldStop(int count, float sum) const {
+    if (count >= maxSamples) return true;
+    return count >= minSamples && fabsf(sum) >= stopMargin * count;
+  }
+};
+
 struct AMAFStats {
   Stats white;
   Stats black;
@@ -141,6 +177,8 @@ struct AMAFStats {
 struct IterationResult {
   pair<StateInfo *, Action> transitions[60];
   float value;
+  // weight of value in backup, the number of samples it averages
+  int samples = ::samples;
   bool firstStateBlack;
   int countTransitions = 0;
   AMAFStats amafStats[60];
@@ -151,72 +189,141 @@ struct IterationResult {
   }
 };
 
-struct McRaveAgent {
+// outcome of a search with a fixed budget, for offline analysis
+struct Analysis {
+  Move bestMove;
+  // q1 of the best move, for the player to move
+  float value;
+  int visits;
+  int iterations;
+  double time;
+  int depth;
+  // "win" or "loss" when the position is proven, otherwise "unknown"
+  const char *status;
+};
+
+// The search options set on the command line. The agents of a service or
+// an analysis copy them whole from one configured prototype, the network
+// and the knowledge store being shared.
+struct SearchSettings {
+  int maxIterations = 200000;
+  // a full tree evicts its least visited nodes to grow further
+  int maxNodes = 120000;
+  PageMode pageMode = PageMode::Normal;
+
+  // hybrid mode, off unless a network is loaded: new actions start with
+  // priorVisits visits at the network value of the state they lead to, and
+  // networkSamples of the samples playouts of a leaf are replaced by the
+  // network value of the leaf
+  shared_ptr<const QuantizedNetwork> valueNetwork;
+  int priorVisits = 4;
+  int networkSamples = 0;
+  SamplingPolicy sampling;
+  // playouts stop at positions with at most this many walls left to play and
+  // take the exact result from getWinningAction, 0 plays them to the end
+  int playoutSolverThreshold = 0;
+  // run the first minSamples playouts of a leaf through PlayoutBatch
+  bool batchedPlayouts = true;
+
+  // getBestMove writes a JSON line per searched move to this descriptor
+  int statsFd = -1;
+  bool phaseTimers = false;
+
+  // warm start: new nodes found in the store take its proofs and its
+  // statistics, capped at knowledgeVisits visits each
+  shared_ptr<const KnowledgeStore> knowledge;
+  int knowledgeVisits = 10000;
+  // nodes with learnMinVisits visits and proven ones are saved to
+  // learnPath.<pid> at the end of the game, for the knowledge tool to merge
+  string learnPath;
+  unsigned int learnMinVisits = 1000;
+};
+
+struct McRaveAgent : SearchSettings {
   McRaveAgent();
 
   void simulate(const Position &pos);
   static int getWinningAction(const Position &pos);
   void simulateDefault(const Position &pos, IterationResult &result);
-  int simulateTree(Position &pos, IterationResult &result,
-                   StateInfo *lastState = nullptr,
-                   ActionInfo *lastAction = nullptr);
+  static void addPlayout(IterationResult &result,
+                         const pair<bool, int> *actions, int len, float value);
+  int simulateTree(Position &pos, IterationResult &result);
   float eval(const Position &pos, const Move &move);
   Move select(const Position &pos);
+  int selectAction(const Position &pos, const StateInfo &stateInfo);
   Move selectMostVisited(const Position &pos);
   void backup(const IterationResult &result);
   StateInfo &newNode(const Position &pos);
+  void evict(const Position &pos);
   pair<bool, Move> getBestMove(const Position &pos,
                                bool useTimeConstraint = true);
   void log(const Position &pos, const Move &move);
+  void writeSearchRecord(const Position &pos, const Move &move,
+                         const char *result, int iterations, double dt);
   int getDepth(const Position &pos);
   void launchDebugSession(const Position &pos);
-
-  inline void pickTransformation() {
-    transformationIndex = gen.lessThan(8);
-    cerr << "Using transformation=" << transformationIndex << endl;
-  }
-
-  inline State transformState(State state) {
-    auto transformedState = emptyBitmask;
-    for (int wall = 0; wall < 60; ++wall) {
-      if (::contains(state, wall)) {
-        add(transformedState, transformations[transformationIndex][wall]);
-      }
-    }
-    return transformedState;
-  }
+  Analysis analyze(const Position &pos, int iterations, double maxTime);
+
+  // takes settings whole, the tree and the timers following its pageMode
+  // and phaseTimers; settings can be this agent's own, the tree must be
+  // empty
+  void useSettings(const SearchSettings &settings);
+  // makes a search depend on its position, budget and seed only, not on
+  // the thread running it or on the searches done before
+  void reseed(unsigned int seed);
+
+  bool useKnowledge(const string &filename);
+  void seed(State state, StateInfo &info) const;
+  // takes back what seed and the network prior gave the node when it was
+  // built, leaving what the games searched
+  void unseed(State state, StateInfo &info) const;
+  void learn();
+  bool saveKnowledge();
+
+  inline void pickTransformation() { book.pickTransformation(gen); }
+
+  bool useValueNetwork(const string &filename);
+  // value of the state for the player to move, from the value network
+  float estimate(State state) const { return valueNetwork->run(state); }
 
   void clean(const Position &pos) {
+    const auto start = getTimePoint();
+    const auto size = m.size();
     cerr << "ri=" << m.size() << " ";
-    for (auto it = m.begin(); it != m.end();) {
-      const auto &state = it->first;
-      const auto &invalid = it->second.invalid;
+    m.eraseIf([&pos](State state, const StateInfo &info) {
       auto diff = pos.state & (~state);
-      if ((diff & invalid) != diff) {
-        it = m.erase(it);
-      } else {
-        ++it;
-      }
-    }
+      return (diff & info.invalid) != diff;
+    });
     cerr << "rf=" << m.size() << endl;
-    m.reserve(120000);
+    m.reserve(maxNodes);
+    SearchStats::add(stats.cleanedNodes, size - m.size());
+    SearchStats::add(stats.cleanTime, getDeltaTimeSince(start));
   }
 
-  bool contains(State s) { return m.find(s) != m.end(); }
+  // caps the tree to about megabytes of memory
+  void setTreeBudget(int megabytes) {
+    auto nodes = (static_cast<size_t>(megabytes) << 20) / nodeBytes;
+    const size_t limit = numeric_limits<int>::max();
+    maxNodes = static_cast<int>(clamp<size_t>(nodes, 1, limit));
+  }
 
-  robin_hood::unordered_map<State, StateInfo> m;
+  bool contains(State s) { return m.find(s) != nullptr; }
+
+  NodeTable<StateInfo> m;
 
   RNG gen;
-  double totalTime;
-  int transformationIndex = 0;
+  TimeManager clock;
+  OpeningBookLookup book;
   bool canClaimWin = true;
   int me;
-  static constexpr double r = 1.0;
-  static constexpr double defaultMaxTime = r * 2.0;
-  static constexpr double maxCheckTime = r * 0.25;
-  static constexpr double maxTotalTime = r * 30.0;
-  static constexpr double timeTroubleThreshold = r * 25.0;
-  static constexpr int maxIterations = 200000;
+  // memory of a tree node with its share of the hash table
+  static constexpr size_t nodeBytes = sizeof(State) + sizeof(StateInfo) + 16;
+  // the solver is exponential in the walls left: 0.5us on average and 13us
+  // at worst for 8 walls, 7us and 577us for 14
+  static constexpr int maxPlayoutSolverThreshold = 8;
+  PlayoutBatch playouts;
+
+  SearchStats stats;
+  PhaseTimers timers;
+  KnowledgeBuilder learned;
 };
-
-extern const robin_hood::unordered_map<State, int> openingBook;
@@ -2,36 +2,66 @@
 
 #include <floatfann.h>
 
-RNG NNAgent::gen;
+thread_local RNG NNAgent::gen;
 
-NNAgent::NNAgent(const NNAgent &other) { ann = fann_copy(other.ann); }
+NNAgent::NNAgent(const NNAgent &other)
+    : cache(other.cache),
+      quantized(other.quantized),
+      network(other.network) {
+  ann = other.ann ? fann_copy(other.ann) : nullptr;
+}
 
 NNAgent &NNAgent::operator=(const NNAgent &other) {
-  fann_destroy(ann);
-  ann = fann_copy(other.ann);
+  if (ann) fann_destroy(ann);
+  ann = other.ann ? fann_copy(other.ann) : nullptr;
+  cache = other.cache;
+  quantized = other.quantized;
+  network = other.network;
   return *this;
 }
 
-NNAgent::NNAgent() {
+NNAgent::NNAgent() : cache(make_shared<EvalCache>()) {
   ann = fann_create_standard(4, 60, 40, 20, 1);
   fann_set_activation_function_hidden(ann, FANN_SIGMOID_SYMMETRIC);
   fann_set_activation_function_output(ann, FANN_SIGMOID_SYMMETRIC);
 }
 
-NNAgent::NNAgent(const string &filename) {
+NNAgent::NNAgent(const string &filename) : cache(make_shared<EvalCache>()) {
   ann = fann_create_from_file(filename.c_str());
 }
 
-NNAgent::~NNAgent() { fann_destroy(ann); }
+NNAgent::NNAgent(shared_ptr<const FloatNetwork> network,
+                 shared_ptr<EvalCache> cache)
+    : ann(nullptr), cache(move(cache)), network(move(network)) {}
+
+NNAgent::~NNAgent() {
+  if (ann) fann_destroy(ann);
+}
 
 void NNAgent::save(const string &filename) { fann_save(ann, filename.c_str()); }
 
-void NNAgent::train(fann_train_data *train_data) {
-  fann_train_on_data(ann, train_data, 100, 10, 0.000001f);
-  fann_destroy_train(train_data);
+float NNAgent::train(int steps, unsigned int batchSize,
+                     const function<void(fann_train_data *)> &fillBatch) {
+  // every step sees a fresh minibatch: fann's default rprop adapts its step
+  // sizes to one fixed training set, plain stochastic gradient descent does
+  // not need one
+  fann_set_training_algorithm(ann, FANN_TRAIN_INCREMENTAL);
+  fann_set_learning_rate(ann, learningRate);
+  auto batch = fann_create_train(batchSize, 60, 1);
+  float mse = 0.0f;
+  for (int step = 0; step < steps; ++step) {
+    fillBatch(batch);
+    mse = fann_train_epoch(ann, batch);
+  }
+  fann_destroy_train(batch);
+  // other copies may still use the old weights and their cached values
+  cache = make_shared<EvalCache>();
+  quantized.reset();
+  network.reset();
+  return mse;
 }
 
-void NNAgent::selfPlay(list<Example> &examples) {
+void NNAgent::selfPlay(vector<Example> &examples) {
   vector<pair<int, State>> states;
   Position pos;
   while (!pos.isEndGame()) {
@@ -50,10 +80,9 @@ void NNAgent::selfPlay(list<Example> &examples) {
 }
 
 Move NNAgent::getBestMove(const Position &pos) {
-  m.clear();
-  turn0 = pos.turns;
+  prepareRoot(pos);
 
-  constexpr int maxIterations = 400;
+  constexpr int maxIterations = 50;
   for (int i = 0; i < maxIterations; ++i) {
     simulate(pos);
   }
@@ -70,38 +99,136 @@ void NNAgent::simulate(const Position &pos) {
   backup(transitions, result);
 }
 
+// Walks down the tree to a leaf: a new node is expanded and left by a random
+// move, the leaf being the position after it.
 void NNAgent::simulateTree(Position &pos, vector<Transition> &transitions) {
-  if (pos.isEndGame()) return;
+  for (;;) {
+    // expanded nodes are never terminal and know the zones of their actions
+    auto state = pos.state;
+    auto it = m.find(state);
+    if (it == m.end()) {
+      if (pos.isEndGame()) return;
+      newNode(pos);
+      Move move;
+      pos.getRandomMove(gen, move);
+      transitions.emplace_back(state, move.wall, pos.turns & 1);
+      pos.doMove(move);
+      return;
+    }
 
-  auto state = pos.state;
-  if (!contains(state)) {
-    newNode(pos);
-    Move move;
-    pos.getRandomMove(gen, move);
-    pos.doMove(move);
-    transitions.emplace_back(state, move.wall, pos.turns & 1);
-    return;
+    auto &info = it->second;
+    if (!info.hasPriors) setPriors(pos, info);
+    int a = info.select();
+    transitions.emplace_back(state, a, pos.turns & 1);
+    pos.doMove(info.getMove(a));
   }
-
-  auto move = select(pos);
-  transitions.emplace_back(state, move.wall, pos.turns & 1);
-  pos.doMove(move);
 }
 
+// The network sees the canonical image only: training draws a random image
+// of every example, so the 8 images give about the same value for 8 times
+// the work.
 float NNAgent::estimate(State state) {
+  auto key = getCanonicalState(getAllTransformations(state));
   auto value = 0.0f;
-  for (auto s : getAllTransformations(state)) {
-    vector<float> input(60);
-    for (int i = 0; i < 60; ++i) {
-      if (::contains(s, i)) {
-        input[i] = 1.0f;
-      } else {
-        input[i] = 0.0f;
-      }
+  if (cache->find(key, value)) return value;
+
+  value = runNetwork(key);
+  cache->store(key, value);
+  return value;
+}
+
+void NNAgent::estimate(const State *states, int n, float *values) {
+  // the states missing from the cache go through the network together
+  vector<int> missing;
+  vector<State> keys;
+  for (int i = 0; i < n; ++i) {
+    auto key = getCanonicalState(getAllTransformations(states[i]));
+    if (cache->find(key, values[i])) continue;
+    missing.push_back(i);
+    keys.push_back(key);
+  }
+  if (missing.empty()) return;
+
+  vector<float> outputs(keys.size());
+  runNetwork(keys.data(), keys.size(), outputs.data());
+  for (size_t j = 0; j < missing.size(); ++j) {
+    values[missing[j]] = outputs[j];
+    cache->store(keys[j], outputs[j]);
+  }
+}
+
+float NNAgent::runNetwork(State state) {
+  if (quantized) return quantized->run(state);
+  if (network) return network->run(state);
+
+  float input[60];
+  for (int i = 0; i < 60; ++i) {
+    input[i] = ::contains(state, i) ? 1.0f : 0.0f;
+  }
+  return fann_run(ann, input)[0];
+}
+
+void NNAgent::runNetwork(const State *states, int n, float *values) {
+  if (quantized) return quantized->run(states, n, values);
+  for (int i = 0; i < n; ++i) values[i] = runNetwork(states[i]);
+}
+
+FloatNetwork NNAgent::getFloatNetwork() const {
+  const auto numLayers = fann_get_num_layers(ann);
+  vector<unsigned int> sizes(numLayers), biases(numLayers);
+  fann_get_layer_array(ann, sizes.data());
+  fann_get_bias_array(ann, biases.data());
+  vector<fann_connection> connections(fann_get_total_connections(ann));
+  fann_get_connection_array(ann, connections.data());
+
+  // fann numbers neurons globally, each layer ending with its bias neuron
+  vector<unsigned int> first(numLayers);
+  for (unsigned int l = 1; l < numLayers; ++l) {
+    first[l] = first[l - 1] + sizes[l - 1] + biases[l - 1];
+  }
+
+  FloatNetwork network;
+  for (unsigned int l = 1; l < numLayers; ++l) {
+    FloatLayer layer;
+    layer.inputs = sizes[l - 1];
+    layer.outputs = sizes[l];
+    switch (fann_get_activation_function(ann, l, 0)) {
+      case FANN_LINEAR:
+        layer.activation = Activation::Linear;
+        break;
+      case FANN_SIGMOID_SYMMETRIC:
+        layer.activation = Activation::SigmoidSymmetric;
+        break;
+      default:
+        layer.activation = Activation::Unsupported;
+    }
+    layer.steepness = fann_get_activation_steepness(ann, l, 0);
+    layer.weights.assign(layer.inputs * layer.outputs, 0.0f);
+    layer.bias.assign(layer.outputs, 0.0f);
+    network.layers.push_back(move(layer));
+  }
+
+  for (const auto &c : connections) {
+    int l = upper_bound(first.begin(), first.end(), c.to_neuron) -
+            first.begin() - 1;
+    auto &layer = network.layers[l - 1];
+    int o = c.to_neuron - first[l];
+    int i = c.from_neuron - first[l - 1];
+    if (i == layer.inputs) {
+      layer.bias[o] = c.weight;
+    } else {
+      layer.weights[i * layer.outputs + o] = c.weight;
     }
-    value += fann_run(ann, input.data())[0];
   }
-  return 0.125f * value;
+  return network;
+}
+
+bool NNAgent::useQuantized(const string &filename) {
+  auto network = make_shared<QuantizedNetwork>();
+  if (!network->load(filename)) return false;
+  quantized = network;
+  cache = make_shared<EvalCache>();
+  return true;
 }
 
 float NNAgent::simulateDefault(const Position &pos) {
@@ -113,13 +240,13 @@ float NNAgent::simulateDefault(const Position &pos) {
 }
 
 Move NNAgent::select(const Position &pos) {
-  int best = m[pos.state].select();
-  return pos.getMove(best);
+  const auto &stateInfo = m[pos.state];
+  return stateInfo.getMove(stateInfo.select());
 }
 
 Move NNAgent::selectMostVisited(const Position &pos) {
-  int mostVisited = m[pos.state].selectMostVisited();
-  return pos.getMove(mostVisited);
+  const auto &stateInfo = m[pos.state];
+  return stateInfo.getMove(stateInfo.selectMostVisited());
 }
 
 void NNAgent::backup(const vector<Transition> &transitions, float result) {
@@ -132,25 +259,70 @@ void NNAgent::backup(const vector<Transition> &transitions, float result) {
   }
 }
 
-StateInfo &NNAgent::newNode(const Position &pos) {
+NNAgent::StateInfo &NNAgent::newNode(const Position &pos) {
   auto &info = m[pos.state];
   info.invalid = (~pos.placed) & (~pos.possibleWalls);
   for (const Move &move : pos) {
+    auto &actionInfo = info.actionInfo[move.wall];
+    actionInfo.zoneSquares = move.zone.squares;
+    actionInfo.p = 0.0f;
+    actionInfo.valid = true;
     info.actionsCount++;
-    auto nextState = pos.getStateAfterPlaying(move);
-    float p = -estimate(nextState) +
-              (pos.turns == turn0 ? 0.01f * gen.lessThan(11) : 0.0f);
-    info.actionInfo[move.wall].p = p;
-    info.actionInfo[move.wall].valid = true;
   }
   return info;
 }
 
-Move NNAgent::getBestMoveForSelfPlay(const Position &pos) {
-  m.clear();
+// The priors are the values of the children, evaluated when a descent first
+// selects an action of the node: most nodes are only the leaf of the
+// simulation that built them and never need them.
+void NNAgent::setPriors(const Position &pos, StateInfo &info) {
+  State nextStates[60];
+  float values[60];
+  int walls[60];
+  int count = 0;
+  for (int a = 0; a < 60; ++a) {
+    if (!info.actionInfo[a]) continue;
+    walls[count] = a;
+    nextStates[count++] = pos.getStateAfterPlaying(info.getMove(a));
+  }
+  estimate(nextStates, count, values);
+
+  for (int i = 0; i < count; ++i) {
+    info.actionInfo[walls[i]].p =
+        -values[i] + (pos.turns == turn0 ? 0.01f * gen.lessThan(11) : 0.0f);
+  }
+  info.hasPriors = true;
+}
+
+void NNAgent::prepareRoot(const Position &pos) {
   turn0 = pos.turns;
+  clean(pos);
+  // a kept root got its priors as an inner node, give it the root noise now
+  if (auto it = m.find(pos.state); it != m.end() && it->second.hasPriors) {
+    for (auto &info : it->second.actionInfo) {
+      if (info) info.p += 0.01f * gen.lessThan(11);
+    }
+  }
+}
+
+void NNAgent::clean(const Position &pos) {
+  for (auto it = m.begin(); it != m.end();) {
+    const auto &state = it->first;
+    const auto &invalid = it->second.invalid;
+    auto diff = pos.state & (~state);
+    if ((diff & invalid) != diff) {
+      it = m.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  m.reserve(reservedNodes);
+}
+
+Move NNAgent::getBestMoveForSelfPlay(const Position &pos) {
+  prepareRoot(pos);
 
-  constexpr int maxIterations = 200;
+  constexpr int maxIterations = 25;
   for (int i = 0; i < maxIterations; ++i) {
     simulate(pos);
   }
@@ -1,8 +1,14 @@
 #pragma once
 
+#include <functional>
+#include <memory>
+
 #include "Common.h"
+#include "EvalCache.h"
+#include "Network.h"
 #include "Position.h"
 #include "RNG.h"
+#include "robin_hood.h"
 
 struct Example {
   State state;
@@ -19,72 +25,83 @@ inline ostream &operator<<(ostream &out, const Example &example) {
   return out;
 }
 
-struct ActionInfo {
-  ActionInfo() {}
+using Transition = tuple<State, int, int>;
 
-  Stats q;
-  float p;
-  bool valid = false;
+struct fann;
+struct fann_train_data;
+struct NNAgent {
+  // search tree nodes, nested so they do not clash with McRaveAgent's
+  struct ActionInfo {
+    ActionInfo() {}
+
+    Stats q;
+    float p;
+    bool valid = false;
+    // squares of the zone this action closes, saved at expansion
+    uint32_t zoneSquares = 0;
+
+    operator bool() const { return valid; }
+  };
+
+  struct StateInfo {
+    StateInfo() : actionsCount(0), visits(0), hasPriors(false) {}
+
+    ActionInfo actionInfo[60];
+    Bitmask invalid;
+    int actionsCount;
+    int visits;
+    bool hasPriors;
+
+    float eval(int a) const {
+      const auto &info = actionInfo[a];
+      assert(info.valid);
+      return info.q.value + info.p * sqrtf(visits) / (1.0f + info.q.visits);
+    }
 
-  operator bool() const { return valid; }
-};
+    Move getMove(int a) const {
+      const auto squares = actionInfo[a].zoneSquares;
+      return {a, squares ? zoneOfSquares(squares) : Zone{}};
+    }
 
-struct StateInfo {
-  StateInfo() : actionsCount(0), visits(0) {}
-
-  ActionInfo actionInfo[60];
-  Bitmask invalid;
-  int actionsCount;
-  int visits;
-
-  float eval(int a) const {
-    const auto &[q, p, valid] = actionInfo[a];
-    assert(valid);
-    return q.value + p * sqrtf(visits) / (1.0f + q.visits);
-  }
-
-  int select() const {
-    int best = -1;
-    float bestValue = numeric_limits<float>::lowest();
-    for (int a = 0; a < 60; ++a) {
-      if (!actionInfo[a]) continue;
-      auto value = eval(a);
-      if (bestValue < value) {
-        best = a;
-        bestValue = value;
+    int select() const {
+      int best = -1;
+      float bestValue = numeric_limits<float>::lowest();
+      for (int a = 0; a < 60; ++a) {
+        if (!actionInfo[a]) continue;
+        auto value = eval(a);
+        if (bestValue < value) {
+          best = a;
+          bestValue = value;
+        }
       }
+      return best;
     }
-    return best;
-  }
-
-  int selectMostVisited() const {
-    int mostVisited = -1;
-    float maxVisits = numeric_limits<int>::lowest();
-    for (int a = 0; a < 60; ++a) {
-      if (!actionInfo[a]) continue;
-      int visits = actionInfo[a].q.visits;
-      if (maxVisits < visits) {
-        maxVisits = visits;
-        mostVisited = a;
+
+    int selectMostVisited() const {
+      int mostVisited = -1;
+      float maxVisits = numeric_limits<int>::lowest();
+      for (int a = 0; a < 60; ++a) {
+        if (!actionInfo[a]) continue;
+        int visits = actionInfo[a].q.visits;
+        if (maxVisits < visits) {
+          maxVisits = visits;
+          mostVisited = a;
+        }
       }
+      return mostVisited;
     }
-    return mostVisited;
-  }
 
-  void update(int a, float value) {
-    ++visits;
-    actionInfo[a].q.update(value);
-  }
-};
-
-using Transition = tuple<State, int, int>;
+    void update(int a, float value) {
+      ++visits;
+      actionInfo[a].q.update(value);
+    }
+  };
 
-struct fann;
-struct fann_train_data;
-struct NNAgent {
   NNAgent();
   NNAgent(const NNAgent &other);
   NNAgent(const string &filename);
+  // agent without its own fann, reading weights shared with other threads
+  NNAgent(shared_ptr<const FloatNetwork> network, shared_ptr<EvalCache> cache);
   NNAgent &operator=(const NNAgent &other);
 
   ~NNAgent();
@@ -97,17 +114,38 @@ struct NNAgent {
   Move selectMostVisited(const Position &pos);
   void backup(const vector<Transition> &transitions, float value);
   StateInfo &newNode(const Position &pos);
+  void setPriors(const Position &pos, StateInfo &info);
   Move getBestMove(const Position &pos);
   Move getBestMoveForSelfPlay(const Position &pos);
-
-  void train(fann_train_data *train_data);
-  void selfPlay(list<Example> &examples);
+  void prepareRoot(const Position &pos);
+  // drops the nodes that can not be reached from pos anymore
+  void clean(const Position &pos);
+
+  // runs `steps` epochs, each on a fresh minibatch of batchSize rows written
+  // by fillBatch, and returns the MSE of the last one
+  float train(int steps, unsigned int batchSize,
+              const function<void(fann_train_data *)> &fillBatch);
+  // step size of the incremental training, fann's default of 0.7 diverges
+  static constexpr float learningRate = 0.01f;
+  void selfPlay(vector<Example> &examples);
   void save(const string &filename);
   float estimate(State state);
+  void estimate(const State *states, int n, float *values);
+  float runNetwork(State state);
+  void runNetwork(const State *states, int n, float *values);
+  FloatNetwork getFloatNetwork() const;
+  bool useQuantized(const string &filename);
   bool contains(State s) { return m.find(s) != m.end(); }
 
   fann *ann;
-  unordered_map<State, StateInfo> m;
-  static RNG gen;
+  // shared by every copy holding the same weights, replaced when they change
+  shared_ptr<EvalCache> cache;
+  // int8 inference path used by estimate() instead of fann when loaded
+  shared_ptr<const QuantizedNetwork> quantized;
+  shared_ptr<const FloatNetwork> network;
+  // kept between moves, only the subtrees left behind are pruned
+  robin_hood::unordered_flat_map<State, StateInfo> m;
+  static constexpr size_t reservedNodes = 4096;
+  static thread_local RNG gen;
   int turn0;
 };
@@ -0,0 +1,267 @@
+#include "Network.h"
+
+#include <immintrin.h>
+
+#include <fstream>
+
+namespace {
+
+constexpr char magic[4] = {'Z', 'Q', 'N', 'N'};
+constexpr uint32_t version = 1;
+
+float activate(Activation activation, float steepness, float sum) {
+  if (activation == Activation::Linear) return steepness * sum;
+  return tanhf(steepness * sum);
+}
+
+// sigmoid-symmetric activations of hidden layers go straight back to int8
+// through a table of tanh in steps of 1/256 over [-4, 4], 127 * tanh(x)
+// rounding to +-127 beyond 3.2: the result is within 0.75 of an int8 step of
+// 127 * tanh(x), against 0.5 for exact rounding
+constexpr int tanhResolution = 256;
+constexpr int tanhRange = 4 * tanhResolution;
+
+struct TanhTable {
+  TanhTable() {
+    for (int i = -tanhRange; i <= tanhRange; ++i) {
+      float y = tanhf(static_cast<float>(i) / tanhResolution);
+      values[i + tanhRange] = static_cast<int8_t>(lrintf(127.0f * y));
+    }
+  }
+
+  int8_t operator()(float x) const {
+    int i = static_cast<int>(lrintf(x * tanhResolution));
+    i = max(-tanhRange, min(tanhRange, i));
+    return values[i + tanhRange];
+  }
+
+  int8_t values[2 * tanhRange + 1];
+};
+
+const TanhTable tanhTable;
+
+inline int32_t dot(const int8_t *w, const int8_t *a, int n) {
+#if defined(__AVX2__)
+  // maddubs/dpbusd multiply unsigned by signed bytes: move the sign of the
+  // activation onto the weight and use its absolute value
+  __m256i acc = _mm256_setzero_si256();
+  for (int i = 0; i < n; i += 32) {
+    auto va = _mm256_load_si256(reinterpret_cast<const __m256i *>(a + i));
+    auto vw = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(w + i));
+    auto ua = _mm256_sign_epi8(va, va);
+    auto sw = _mm256_sign_epi8(vw, va);
+#if defined(__AVXVNNI__)
+    acc = _mm256_dpbusd_avx_epi32(acc, ua, sw);
+#elif defined(__AVX512VNNI__) && defined(__AVX512VL__)
+    acc = _mm256_dpbusd_epi32(acc, ua, sw);
+#else
+    auto pairs = _mm256_maddubs_epi16(ua, sw);
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(pairs, _mm256_set1_epi16(1)));
+#endif
+  }
+  auto s = _mm_add_epi32(_mm256_castsi256_si128(acc),
+                         _mm256_extracti128_si256(acc, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+  return _mm_cvtsi128_si32(s);
+#else
+  int32_t acc = 0;
+  for (int i = 0; i < n; ++i) acc += w[i] * a[i];
+  return acc;
+#endif
+}
+
+template <typename T>
+void write(ostream &out, const T &value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+bool read(istream &in, T &value) {
+  return static_cast<bool>(in.read(reinterpret_cast<char *>(&value), sizeof(T)));
+}
+
+}  // namespace
+
+float FloatNetwork::run(State state) const {
+  float buffer[2][QuantizedNetwork::maxWidth];
+  float *in = buffer[0], *out = buffer[1];
+  for (int w = 0; w < 60; ++w) in[w] = contains(state, w) ? 1.0f : 0.0f;
+
+  // accumulate one input column at a time: the inner loop has no dependency
+  // between outputs and vectorizes, and the zero inputs of the first layer
+  // (every empty wall) are skipped
+  for (const auto &layer : layers) {
+    copy(layer.bias.begin(), layer.bias.end(), out);
+    const float *column = layer.weights.data();
+    for (int i = 0; i < layer.inputs; ++i, column += layer.outputs) {
+      const float x = in[i];
+      if (x == 0.0f) continue;
+      for (int o = 0; o < layer.outputs; ++o) out[o] += column[o] * x;
+    }
+    for (int o = 0; o < layer.outputs; ++o) {
+      out[o] = activate(layer.activation, layer.steepness, out[o]);
+    }
+    swap(in, out);
+  }
+  return in[0];
+}
+
+QuantizedNetwork QuantizedNetwork::quantize(const FloatNetwork &network) {
+  QuantizedNetwork result;
+  for (const auto &layer : network.layers) {
+    if (layer.activation != Activation::Linear &&
+        layer.activation != Activation::SigmoidSymmetric) {
+      cerr << "Unsupported activation for int8 kernel, only linear and "
+              "sigmoid symmetric layers can be quantized"
+           << endl;
+      return {};
+    }
+    if (layer.inputs > maxWidth || layer.outputs > maxWidth) {
+      cerr << "Layer too wide for int8 kernel: " << layer.inputs << "x"
+           << layer.outputs << endl;
+      return {};
+    }
+
+    QuantizedLayer q;
+    q.inputs = layer.inputs;
+    q.outputs = layer.outputs;
+    q.stride = (layer.inputs + 31) & ~31;
+    q.activation = layer.activation;
+    q.steepness = layer.steepness;
+
+    float maxWeight = 0.0f;
+    for (auto w : layer.weights) maxWeight = max(maxWeight, fabsf(w));
+    float weightScale = maxWeight > 0.0f ? maxWeight / 127.0f : 1.0f;
+    q.scale = weightScale / 127.0f;
+
+    q.weights.assign(q.outputs * q.stride, 0);
+    for (int o = 0; o < q.outputs; ++o) {
+      for (int i = 0; i < q.inputs; ++i) {
+        float w = layer.weights[i * q.outputs + o] / weightScale;
+        q.weights[o * q.stride + i] =
+            static_cast<int8_t>(max(-127.0f, min(127.0f, rintf(w))));
+      }
+      q.bias.push_back(static_cast<int32_t>(lrintf(layer.bias[o] / q.scale)));
+    }
+    result.layers.push_back(move(q));
+  }
+  return result;
+}
+
+bool QuantizedNetwork::save(const string &filename) const {
+  ofstream out(filename, ios::binary);
+  out.write(magic, sizeof(magic));
+  write(out, version);
+  write(out, static_cast<uint32_t>(layers.size()));
+  for (const auto &layer : layers) {
+    write(out, layer.inputs);
+    write(out, layer.outputs);
+    write(out, layer.activation);
+    write(out, layer.steepness);
+    write(out, layer.scale);
+    out.write(reinterpret_cast<const char *>(layer.bias.data()),
+              layer.bias.size() * sizeof(int32_t));
+    for (int o = 0; o < layer.outputs; ++o) {
+      out.write(reinterpret_cast<const char *>(&layer.weights[o * layer.stride]),
+                layer.inputs);
+    }
+  }
+  return static_cast<bool>(out);
+}
+
+bool QuantizedNetwork::load(const string &filename) {
+  ifstream in(filename, ios::binary);
+  char header[sizeof(magic)];
+  uint32_t fileVersion, count;
+  if (!in.read(header, sizeof(header)) || !equal(header, header + 4, magic) ||
+      !read(in, fileVersion) || fileVersion != version || !read(in, count)) {
+    cerr << "Not a quantized network: " << filename << endl;
+    return false;
+  }
+
+  layers.clear();
+  for (uint32_t l = 0; l < count; ++l) {
+    QuantizedLayer q;
+    if (!read(in, q.inputs) || !read(in, q.outputs) ||
+        !read(in, q.activation) || !read(in, q.steepness) ||
+        !read(in, q.scale) || q.inputs > maxWidth || q.outputs > maxWidth ||
+        (q.activation != Activation::Linear &&
+         q.activation != Activation::SigmoidSymmetric)) {
+      cerr << "Corrupted quantized network: " << filename << endl;
+      return false;
+    }
+    q.stride = (q.inputs + 31) & ~31;
+    q.bias.resize(q.outputs);
+    q.weights.assign(q.outputs * q.stride, 0);
+    in.read(reinterpret_cast<char *>(q.bias.data()),
+            q.outputs * sizeof(int32_t));
+    for (int o = 0; o < q.outputs; ++o) {
+      in.read(reinterpret_cast<char *>(&q.weights[o * q.stride]), q.inputs);
+    }
+    if (!in) {
+      cerr << "Truncated quantized network: " << filename << endl;
+      return false;
+    }
+    layers.push_back(move(q));
+  }
+  return true;
+}
+
+float QuantizedNetwork::run(State state) const {
+  float value;
+  run(&state, 1, &value);
+  return value;
+}
+
+void QuantizedNetwork::run(const State *states, int n, float *values) const {
+  for (; n > maxBatch; states += maxBatch, values += maxBatch, n -= maxBatch) {
+    run(states, maxBatch, values);
+  }
+
+  alignas(32) int8_t buffer[2][maxBatch][maxWidth];
+  auto *in = buffer[0], *out = buffer[1];
+  for (int j = 0; j < n; ++j) {
+    for (int w = 0; w < maxWidth; ++w) {
+      in[j][w] = w < 60 && contains(states[j], w) ? 127 : 0;
+    }
+  }
+
+  const int last = static_cast<int>(layers.size()) - 1;
+  for (int l = 0; l < last; ++l) {
+    const auto &layer = layers[l];
+    const int8_t *row = layer.weights.data();
+    for (int o = 0; o < layer.outputs; ++o, row += layer.stride) {
+      for (int j = 0; j < n; ++j) {
+        float sum = layer.scale * (dot(row, in[j], layer.stride) + layer.bias[o]);
+        if (layer.activation == Activation::Linear) {
+          float y = 127.0f * layer.steepness * sum;
+          out[j][o] = static_cast<int8_t>(max(-127.0f, min(127.0f, rintf(y))));
+        } else {
+          out[j][o] = tanhTable(layer.steepness * sum);
+        }
+      }
+    }
+    for (int j = 0; j < n; ++j) fill(out[j] + layer.outputs, out[j] + maxWidth, 0);
+    swap(in, out);
+  }
+
+  const auto &layer = layers[last];
+  for (int j = 0; j < n; ++j) {
+    float sum = layer.scale * (dot(layer.weights.data(), in[j], layer.stride) +
+                               layer.bias[0]);
+    values[j] = activate(layer.activation, layer.steepness, sum);
+  }
+}
+
+const char *QuantizedNetwork::kernelName() {
+#if defined(__AVXVNNI__)
+  return "avx-vnni";
+#elif defined(__AVX512VNNI__) && defined(__AVX512VL__)
+  return "avx512-vnni";
+#elif defined(__AVX2__)
+  return "avx2";
+#else
+  return "scalar";
+#endif
+}
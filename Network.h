@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Common.h"
+
+// Plain copies of the value network weights, independent of libfann, with
+// inference kernels that only read them, so any number of threads can share
+// one copy. Inputs are the 60 wall bits of a state encoded as 1.0f / 0.0f
+// like NNAgent feeds fann_run.
+
+// Unsupported stands for any other fann activation, which quantize rejects
+enum class Activation : int { Linear = 0, SigmoidSymmetric = 1, Unsupported };
+
+struct FloatLayer {
+  int inputs;
+  int outputs;
+  Activation activation;
+  float steepness;
+  vector<float> weights;  // inputs x outputs, one column per input
+  vector<float> bias;
+};
+
+struct FloatNetwork {
+  float run(State state) const;
+
+  vector<FloatLayer> layers;
+};
+
+// Symmetric int8 quantization with one weight scale per layer. Activations of
+// every layer are int8 with a fixed scale of 1/127 (sigmoid-symmetric outputs
+// and the binary inputs both live in [-1, 1]), so a layer computes
+//   real = scale * (sum(w_q * a_q) + bias_q), scale = weightScale / 127
+// in int32 and only converts back to float for the final output.
+struct QuantizedLayer {
+  int inputs;
+  int outputs;
+  int stride;  // inputs padded to a multiple of 32 for the SIMD kernels
+  Activation activation;
+  float steepness;
+  float scale;
+  vector<int8_t> weights;  // outputs x stride, row-major, zero padded
+  vector<int32_t> bias;
+};
+
+struct QuantizedNetwork {
+  static constexpr int maxWidth = 64;
+  // states evaluated together by the batched run, each weight row is loaded
+  // once and applied to all of them
+  static constexpr int maxBatch = 32;
+
+  static QuantizedNetwork quantize(const FloatNetwork &network);
+
+  bool load(const string &filename);
+  bool save(const string &filename) const;
+
+  float run(State state) const;
+  void run(const State *states, int n, float *values) const;
+
+  static const char *kernelName();
+
+  vector<QuantizedLayer> layers;
+};
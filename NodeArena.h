@@ -0,0 +1,186 @@
+#pragma once
+
+#include <sys/mman.h>
+
+#include <new>
+
+#include "Common.h"
+#include "robin_hood.h"
+
+// How the memory of search trees is backed. Transparent asks for 2MB pages
+// with madvise (THP in "madvise" or "always" mode), HugeTlb maps them from
+// the hugetlbfs pool (vm.nr_hugepages) and falls back to normal pages when
+// the pool is empty.
+enum class PageMode { Normal, Transparent, HugeTlb };
+
+// Nodes carved out of large mmapped chunks, freed ones being reused first.
+// A page is placed by the kernel when first written, that is by the thread
+// building the node, so with the default first-touch policy the tree of a
+// search thread sits on its own NUMA node.
+template <typename T>
+struct NodeArena {
+  static_assert(is_trivially_destructible_v<T>);
+
+  static constexpr size_t hugePageBytes = 2 << 20;
+  static constexpr size_t chunkBytes = 8 * hugePageBytes;
+  static constexpr size_t chunkNodes = chunkBytes / sizeof(T);
+
+  NodeArena() = default;
+  NodeArena(const NodeArena &) = delete;
+  NodeArena &operator=(const NodeArena &) = delete;
+  ~NodeArena() {
+    for (auto chunk : chunks) munmap(chunk, chunkBytes);
+  }
+
+  T *allocate() {
+    void *node;
+    if (!freed.empty()) {
+      node = freed.back();
+      freed.pop_back();
+    } else {
+      if (used == chunks.size() * chunkNodes) addChunk();
+      node = chunks[used / chunkNodes] + used % chunkNodes;
+      ++used;
+    }
+    return new (node) T();
+  }
+
+  void free(T *node) { freed.push_back(node); }
+
+  // forgets every node, the chunks are kept for the next ones
+  void clear() {
+    freed.clear();
+    used = 0;
+  }
+
+  void addChunk() {
+    constexpr int prot = PROT_READ | PROT_WRITE;
+    constexpr int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void *chunk = MAP_FAILED;
+    if (mode == PageMode::HugeTlb) {
+      // reserved now, an empty pool would otherwise fault on first write
+      chunk = mmap(nullptr, chunkBytes, prot, flags | MAP_HUGETLB, -1, 0);
+      if (chunk == MAP_FAILED && !warned) {
+        cerr << "no huge pages left in the hugetlbfs pool" << endl;
+        warned = true;
+      }
+    }
+    if (chunk == MAP_FAILED) {
+      // mapped one huge page larger to cut out a 2MB aligned chunk
+      auto size = chunkBytes + hugePageBytes;
+      auto area = static_cast<char *>(
+          mmap(nullptr, size, prot, flags | MAP_NORESERVE, -1, 0));
+      if (area == MAP_FAILED) throw bad_alloc();
+      auto head = (hugePageBytes - reinterpret_cast<uintptr_t>(area) %
+                                       hugePageBytes) % hugePageBytes;
+      if (head) munmap(area, head);
+      munmap(area + head + chunkBytes, hugePageBytes - head);
+      chunk = area + head;
+      if (mode == PageMode::Transparent) {
+        madvise(chunk, chunkBytes, MADV_HUGEPAGE);
+      }
+    }
+    chunks.push_back(static_cast<T *>(chunk));
+  }
+
+  PageMode mode = PageMode::Normal;
+  bool warned = false;
+  vector<T *> chunks;
+  // nodes handed out of the chunks, freed ones included
+  size_t used = 0;
+  vector<T *> freed;
+};
+
+// The nodes of a search tree by state. They live in a robin_hood node map,
+// or with huge pages in a NodeArena pointed at by a flat index. Either way
+// nodes never move while the table grows.
+template <typename T>
+struct NodeTable {
+  // only while the table is empty
+  void setPageMode(PageMode mode) {
+    assert(size() == 0);
+    arena.mode = mode;
+  }
+
+  bool usesArena() const { return arena.mode != PageMode::Normal; }
+
+  T *find(State state) {
+    if (!usesArena()) {
+      auto it = nodes.find(state);
+      return it != nodes.end() ? &it->second : nullptr;
+    }
+    auto it = index.find(state);
+    return it != index.end() ? it->second : nullptr;
+  }
+
+  T &operator[](State state) {
+    if (!usesArena()) return nodes[state];
+    if (auto node = find(state)) return *node;
+    // the index only gets the node once it is allocated
+    auto node = arena.allocate();
+    try {
+      index.emplace(state, node);
+    } catch (...) {
+      arena.free(node);
+      throw;
+    }
+    return *node;
+  }
+
+  // calls f(state, node) on every node
+  template <typename F>
+  void forEach(F f) const {
+    if (!usesArena()) {
+      for (const auto &[state, node] : nodes) f(state, node);
+    } else {
+      for (const auto &[state, node] : index) f(state, *node);
+    }
+  }
+
+  // erases the nodes for which erase(state, node) is true, returns how many
+  template <typename F>
+  size_t eraseIf(F erase) {
+    size_t erased = 0;
+    if (!usesArena()) {
+      for (auto it = nodes.begin(); it != nodes.end();) {
+        if (erase(it->first, it->second)) {
+          it = nodes.erase(it);
+          ++erased;
+        } else {
+          ++it;
+        }
+      }
+      return erased;
+    }
+    for (auto it = index.begin(); it != index.end();) {
+      if (erase(it->first, *it->second)) {
+        arena.free(it->second);
+        it = index.erase(it);
+        ++erased;
+      } else {
+        ++it;
+      }
+    }
+    return erased;
+  }
+
+  size_t size() const { return usesArena() ? index.size() : nodes.size(); }
+
+  void reserve(size_t size) {
+    if (usesArena()) {
+      index.reserve(size);
+    } else {
+      nodes.reserve(size);
+    }
+  }
+
+  void clear() {
+    nodes.clear();
+    index.clear();
+    arena.clear();
+  }
+
+  robin_hood::unordered_node_map<State, T> nodes;
+  robin_hood::unordered_flat_map<State, T *> index;
+  NodeArena<T> arena;
+};
@@ -1,4 +1,4 @@
-#include "McRaveAgent.h"
+#include "OpeningBook.h"
 
 const robin_hood::unordered_map<State, int> openingBook{
     // turn=1
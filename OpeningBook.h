@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Common.h"
+#include "Position.h"
+#include "RNG.h"
+#include "robin_hood.h"
+
+extern const robin_hood::unordered_map<State, int> openingBook;
+
+// The book holds one orientation of each position. Every game looks it up
+// under one of the 8 symmetries picked at random so our openings vary.
+struct OpeningBookLookup {
+  void pickTransformation(RNG &gen) {
+    transformationIndex = gen.lessThan(8);
+    cerr << "Using transformation=" << transformationIndex << endl;
+  }
+
+  State transformState(State state) const {
+    return getTransformation(state, transformationIndex);
+  }
+
+  bool find(const Position &pos, Move &move) const {
+    auto it = openingBook.find(transformState(pos.placed));
+    if (it == openingBook.end()) return false;
+    const int *inv = transformations[inverse[transformationIndex]];
+    move = pos.getMove(inv[it->second]);
+    return true;
+  }
+
+  int transformationIndex = 0;
+};
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <atomic>
+#include <csignal>
+
+#include "Common.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Cycle counts of the phases of McRaveAgent::simulate, kept as log2
+// histograms per turn bucket. The timers exist only when built with
+// ZUNIQ_WITH_TIMERS and even then cost a single branch until --phase-timers
+// enables them. Times are inclusive: simulateTree contains newNode, and
+// getWinningAction is the solver of the r <= 5 branch of simulate only, the
+// playout solver counts in simulateDefault.
+
+inline uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  // no time stamp counter, nanoseconds stand in for cycles
+  return chrono::duration_cast<chrono::nanoseconds>(
+             chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+enum class Phase : int {
+  SimulateTree = 0,
+  NewNode = 1,
+  SimulateDefault = 2,
+  GetWinningAction = 3,
+  Backup = 4
+};
+
+constexpr int phasesCount = 5;
+
+constexpr const char *phaseNames[phasesCount] = {
+    "simulateTree", "newNode", "simulateDefault", "getWinningAction",
+    "backup"};
+
+struct CycleHistogram {
+  // bin b counts durations in [2^b, 2^(b+1)) cycles
+  static constexpr int bins = 48;
+
+  uint64_t counts[bins] = {};
+  uint64_t count = 0;
+  uint64_t total = 0;
+
+  void add(uint64_t cycles) {
+    int bin = 63 - __builtin_clzll(cycles | 1);
+    ++counts[min(bin, bins - 1)];
+    ++count;
+    total += cycles;
+  }
+
+  // upper bound of the bin holding the q quantile
+  uint64_t quantile(double q) const {
+    auto rank = static_cast<uint64_t>(q * count);
+    uint64_t seen = 0;
+    for (int b = 0; b < bins; ++b) {
+      seen += counts[b];
+      if (seen > rank) return 2ull << b;
+    }
+    return 2ull << (bins - 1);
+  }
+};
+
+struct PhaseTimers {
+  static constexpr int turnsPerBucket = 10;
+  static constexpr int buckets = 6;
+
+  bool enabled = false;
+  int bucket = 0;
+  CycleHistogram histograms[buckets][phasesCount];
+
+  // set by SIGUSR1, the agent dumps the histograms after its current move
+  static inline atomic<bool> dumpRequested{false};
+
+  static void requestDumpOnSignal() {
+    signal(SIGUSR1, [](int) { dumpRequested = true; });
+  }
+
+  void setTurn(int turns) {
+    bucket = min(buckets - 1, turns / turnsPerBucket);
+  }
+
+  void add(Phase phase, uint64_t cycles) {
+    histograms[bucket][static_cast<int>(phase)].add(cycles);
+  }
+
+  void dump(ostream &out) const {
+    // the shares are printed fixed, later output of out is not
+    const auto flags = out.flags();
+    const auto precision = out.precision();
+    out << "phase timers, cycles per call (quantiles are bin upper bounds)"
+        << endl;
+    for (int b = 0; b < buckets; ++b) {
+      uint64_t bucketTotal = histograms[b][0].total;
+      for (int p = 2; p < phasesCount; ++p) {
+        bucketTotal += histograms[b][p].total;
+      }
+      if (histograms[b][0].count == 0) continue;
+      out << "turns " << b * turnsPerBucket << "-"
+          << (b + 1) * turnsPerBucket - 1 << ":" << endl;
+      for (int p = 0; p < phasesCount; ++p) {
+        const auto &h = histograms[b][p];
+        if (h.count == 0) continue;
+        out << "  " << left << setw(17) << phaseNames[p] << right
+            << " n=" << h.count << " mean=" << h.total / h.count
+            << " p50=" << h.quantile(0.5) << " p90=" << h.quantile(0.9)
+            << " p99=" << h.quantile(0.99) << " share="
+            << fixed << setprecision(1) << 100.0 * h.total / bucketTotal
+            << "%" << endl;
+      }
+    }
+    out.flags(flags);
+    out.precision(precision);
+  }
+};
+
+// times the enclosing scope into timers when they are enabled
+struct ScopedTimer {
+#ifdef ZUNIQ_WITH_TIMERS
+  ScopedTimer(PhaseTimers &timers, Phase phase)
+      : timers(timers.enabled ? &timers : nullptr),
+        phase(phase),
+        start(this->timers ? readCycles() : 0) {}
+
+  ~ScopedTimer() {
+    if (timers) timers->add(phase, readCycles() - start);
+  }
+
+  PhaseTimers *timers;
+  Phase phase;
+  uint64_t start;
+#else
+  ScopedTimer(PhaseTimers &, Phase) {}
+#endif
+};
@@ -0,0 +1,150 @@
+#include "PlayoutBatch.h"
+
+#include <numeric>
+
+namespace {
+
+constexpr int lanes = PlayoutBatch::lanes;
+
+// both sides of every picked wall are flooded at once, side 0 in [0, count)
+// and side 1 in [count, 2 * count)
+struct Flood {
+  Bitmask up[2 * lanes];
+  Bitmask down[2 * lanes];
+  Bitmask left[2 * lanes];
+  Bitmask right[2 * lanes];
+  Bitmask exits[2 * lanes];
+  Bitmask zone[2 * lanes];
+
+  void setup(int j, Bitmask placed, int wall, int count) {
+    // squares whose side is open, the new wall counts as placed
+    auto v = placed >> 30;
+    auto top = ~placed & allSquaresBitmask;
+    auto bottom = ~(placed >> 5) & allSquaresBitmask;
+    auto leftOpen = ~extractBits(v, leftWallsOfRows) & allSquaresBitmask;
+    auto rightOpen = ~extractBits(v, rightWallsOfRows) & allSquaresBitmask;
+
+    up[j] = top & ~firstRowSquares;
+    down[j] = bottom & ~lastRowSquares;
+    left[j] = leftOpen & ~firstColumnSquares;
+    right[j] = rightOpen & ~lastColumnSquares;
+    exits[j] = (top & firstRowSquares) | (bottom & lastRowSquares) |
+               (leftOpen & firstColumnSquares) | (rightOpen & lastColumnSquares);
+
+    // a zone needs the wall to touch placed walls at both ends
+    auto [x, y] = neighborsBitmasksOfWall[wall];
+    bool closing = intersect(placed, x) && intersect(placed, y);
+    const auto &sides = splitBy[wall];
+    zone[j] = closing ? getFlag(sides[0]) : emptyBitmask;
+    zone[j + count] =
+        closing && sides.size() > 1 ? getFlag(sides[1]) : emptyBitmask;
+
+    int k = j + count;
+    up[k] = up[j];
+    down[k] = down[j];
+    left[k] = left[j];
+    right[k] = right[j];
+    exits[k] = exits[j];
+  }
+
+  // grows every zone through open sides until none grows, a zone reaching an
+  // open border wall is not closed and drops to empty
+  void run(int n) {
+    for (bool growing = true; growing;) {
+      growing = false;
+      for (int j = 0; j < n; ++j) {
+        auto z = zone[j];
+        auto next = z | ((z & up[j]) >> 5) | ((z & down[j]) << 5) |
+                    ((z & left[j]) >> 1) | ((z & right[j]) << 1);
+        if (next & exits[j]) next = emptyBitmask;
+        growing |= next != z;
+        zone[j] = next;
+      }
+    }
+  }
+};
+
+}  // namespace
+
+void PlayoutBatch::run(const Position &pos, RNG &gen, int n) {
+  assert(n <= lanes);
+  for (int i = 0; i < n; ++i) {
+    placed[i] = pos.placed;
+    possibleWalls[i] = pos.possibleWalls;
+    possibleSizes[i] = pos.possibleSizes;
+    turns[i] = pos.turns;
+    length[i] = 0;
+  }
+
+  int live[lanes];
+  int liveCount = n;
+  iota(live, live + n, 0);
+
+  Flood flood;
+  Bitmask candidates[lanes];
+  int walls[lanes];
+  Bitmask squares[lanes];
+  while (liveCount) {
+    int picking[lanes];
+    int pickingCount = liveCount;
+    for (int j = 0; j < liveCount; ++j) {
+      int i = live[j];
+      candidates[i] = possibleWalls[i];
+      picking[j] = i;
+    }
+
+    // pick a random wall per lane, lanes whose wall closes a zone of a used
+    // size drop it and pick again
+    while (pickingCount) {
+      int count = 0;
+      for (int j = 0; j < pickingCount; ++j) {
+        int i = picking[j];
+        if (!candidates[i]) {
+          walls[i] = -1;
+          continue;
+        }
+        int r = gen.lessThan(__builtin_popcountll(candidates[i]));
+        walls[i] = __builtin_ctzll(depositBits(1ull << r, candidates[i]));
+        picking[count++] = i;
+      }
+
+      for (int j = 0; j < count; ++j) {
+        int i = picking[j];
+        flood.setup(j, placed[i] | getFlag(walls[i]), walls[i], count);
+      }
+      flood.run(2 * count);
+
+      pickingCount = 0;
+      for (int j = 0; j < count; ++j) {
+        int i = picking[j];
+        squares[i] = flood.zone[j] ? flood.zone[j] : flood.zone[j + count];
+        int size = __builtin_popcountll(squares[i]);
+        if (size && !contains(possibleSizes[i], size)) {
+          remove(candidates[i], walls[i]);
+          picking[pickingCount++] = i;
+        }
+      }
+    }
+
+    int stillLive = 0;
+    for (int j = 0; j < liveCount; ++j) {
+      int i = live[j];
+      if (walls[i] == -1) {
+        value[i] = turns[i] & 1 ? 1.0f : -1.0f;
+        continue;
+      }
+
+      actions[i][length[i]++] = {turns[i] & 1, walls[i]};
+      add(placed[i], walls[i]);
+      remove(possibleWalls[i], walls[i]);
+      if (squares[i]) {
+        auto zone = zoneOfSquares(squares[i]);
+        possibleWalls[i] &= ~zone.walls;
+        remove(possibleSizes[i], zone.size);
+      }
+      ++turns[i];
+      live[stillLive++] = i;
+    }
+    liveCount = stillLive;
+  }
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Common.h"
+#include "Position.h"
+#include "RNG.h"
+
+// Plays up to `lanes` random games from one position in lock step. A lane is
+// only the bitboards a playout needs (placed walls, walls and zone sizes
+// still possible), stored as arrays over lanes so every step runs the same
+// branch-free loop on all of them. Walls are picked with a bit deposit and
+// zones found by flooding square bitboards instead of Position::tryClose.
+struct PlayoutBatch {
+  static constexpr int lanes = 16;
+
+  // plays n <= lanes games to the end, results use IterationResult's
+  // conventions: value is 1.0f when white wins, actions are (black, wall)
+  void run(const Position &pos, RNG &gen, int n);
+
+  Bitmask placed[lanes];
+  Bitmask possibleWalls[lanes];
+  Bitmask possibleSizes[lanes];
+  int turns[lanes];
+
+  float value[lanes];
+  pair<bool, int> actions[lanes][60];
+  int length[lanes];
+};
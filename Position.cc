@@ -53,6 +53,16 @@ void Position::doMove(const string &s) {
   doMove(wall);
 }
 
+bool Position::getLegalMove(const string &s, Move &move) const {
+  for (const auto &m : *this) {
+    if (showWall(m.wall) == s) {
+      move = m;
+      return true;
+    }
+  }
+  return false;
+}
+
 bool Position::isPossibleWall(int wall) const {
   return contains(possibleWalls, wall);
 }
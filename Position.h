@@ -17,6 +17,8 @@ struct Position {
   bool isPossibleSize(int size) const;
 
   bool getRandomMove(RNG& gen, Move& move) const;
+  // the legal move written as s (e.g. "C1h"), false when there is none
+  bool getLegalMove(const string& s, Move& move) const;
 
   Move getMove(int Wall) const;
 
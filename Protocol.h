@@ -0,0 +1,32 @@
+#pragma once
+
+#include <functional>
+
+#include "Common.h"
+#include "Position.h"
+
+// CodeCup referee protocol: "Start" asks white for its first move, otherwise
+// each line is the opponent's move and we answer with ours, followed by "!"
+// when claiming the win. "Quit" ends the game.
+inline void runProtocol(
+    const function<pair<bool, Move>(const Position &)> &getBestMove) {
+  Position pos;
+  for (string s; cin >> s && s != "Quit";) {
+    if (s != "Start") {
+      cerr << s << endl;
+      pos.doMove(s);
+    }
+
+    auto [claimWin, bestMove] = getBestMove(pos);
+    pos.doMove(bestMove);
+    cerr << bestMove;
+    cout << bestMove;
+
+    if (claimWin) {
+      cerr << "!";
+      cout << "!";
+    }
+    cerr << endl;
+    cout << endl;
+  }
+}
@@ -0,0 +1,122 @@
+#include <fstream>
+
+#include "Common.h"
+#include "ExampleStore.h"
+#include "NNAgent.h"
+#include "Network.h"
+
+// Converts a trained .ann into the int8 format used by `zeroplayer --int8`,
+// then compares both networks on an examples file (the binary format of
+// coaching, or the text one of older versions) and times them.
+
+template <typename F>
+double benchmark(const vector<State> &states, F run) {
+  constexpr int rounds = 20;
+  volatile float sink = 0.0f;
+  auto start = getTimePoint();
+  for (int r = 0; r < rounds; ++r) {
+    for (auto s : states) sink = sink + run(s);
+  }
+  return 1e9 * getDeltaTimeSince(start) / (rounds * states.size());
+}
+
+double benchmarkBatch(const vector<State> &states,
+                      const QuantizedNetwork &network) {
+  constexpr int rounds = 20;
+  constexpr int batch = QuantizedNetwork::maxBatch;
+  volatile float sink = 0.0f;
+  float values[batch];
+  auto start = getTimePoint();
+  for (int r = 0; r < rounds; ++r) {
+    for (size_t i = 0; i < states.size(); i += batch) {
+      int n = min<size_t>(batch, states.size() - i);
+      network.run(&states[i], n, values);
+      sink = sink + values[0];
+    }
+  }
+  return 1e9 * getDeltaTimeSince(start) / (rounds * states.size());
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    cerr << "usage: " << argv[0] << " <in.ann> <out.qnn> [examples.bin]"
+         << endl;
+    return 1;
+  }
+
+  NNAgent agent(argv[1]);
+  auto network = agent.getFloatNetwork();
+  auto quantized = QuantizedNetwork::quantize(network);
+  if (quantized.layers.empty() || !quantized.save(argv[2])) {
+    cerr << "Failed to write " << argv[2] << endl;
+    return 1;
+  }
+  cout << "Saved " << argv[2] << " kernel=" << QuantizedNetwork::kernelName()
+       << endl;
+  for (const auto &layer : quantized.layers) {
+    cout << "layer " << layer.inputs << "x" << layer.outputs
+         << " scale=" << layer.scale << endl;
+  }
+
+  const string examplesPath = argc > 3 ? argv[3] : "data/examples.bin";
+  constexpr size_t maxExamples = 100000;
+  vector<Example> examples;
+  ExampleReader reader(examplesPath);
+  if (reader.isOpen()) {
+    for (vector<Example> chunk;
+         examples.size() < maxExamples && reader.next(chunk);) {
+      auto n = min(chunk.size(), maxExamples - examples.size());
+      examples.insert(examples.end(), chunk.begin(), chunk.begin() + n);
+    }
+  } else {
+    cerr << "Reading " << examplesPath << " as text examples" << endl;
+    ifstream in(examplesPath);
+    for (Example e; examples.size() < maxExamples && in >> e;) {
+      examples.push_back(e);
+    }
+  }
+  if (examples.empty()) {
+    cerr << "No examples in " << examplesPath << ", skipping report" << endl;
+    return 0;
+  }
+
+  NNAgent quantizedAgent(argv[1]);
+  quantizedAgent.useQuantized(argv[2]);
+
+  double sumError = 0.0, sumSquaredError = 0.0, maxError = 0.0;
+  int sameSign = 0, floatCorrect = 0, int8Correct = 0;
+  vector<State> states;
+  for (const auto &[state, result] : examples) {
+    float x = agent.estimate(state);
+    float y = quantizedAgent.estimate(state);
+    double error = fabs(x - y);
+    sumError += error;
+    sumSquaredError += error * error;
+    maxError = max(maxError, error);
+    sameSign += (x >= 0.0f) == (y >= 0.0f);
+    floatCorrect += (x >= 0.0f) == (result >= 0.0f);
+    int8Correct += (y >= 0.0f) == (result >= 0.0f);
+    states.push_back(state);
+  }
+
+  const double n = examples.size();
+  cout << fixed << setprecision(5);
+  cout << "examples=" << examples.size() << endl;
+  cout << "mae=" << sumError / n << " rmse=" << sqrt(sumSquaredError / n)
+       << " max-error=" << maxError << endl;
+  cout << setprecision(2);
+  cout << "sign-agreement=" << 100.0 * sameSign / n << "%" << endl;
+  cout << "result-accuracy float=" << 100.0 * floatCorrect / n
+       << "% int8=" << 100.0 * int8Correct / n << "%" << endl;
+
+  auto fannTime = benchmark(states, [&](State s) { return agent.runNetwork(s); });
+  auto floatTime = benchmark(states, [&](State s) { return network.run(s); });
+  auto int8Time = benchmark(states, [&](State s) { return quantized.run(s); });
+  auto batchTime = benchmarkBatch(states, quantized);
+  cout << "fann=" << fannTime << "ns float-kernel=" << floatTime
+       << "ns int8=" << int8Time << "ns int8-batch=" << batchTime
+       << "ns per forward pass" << endl;
+  cout << "speedup over fann=" << fannTime / int8Time << "x" << endl;
+
+  return 0;
+}
@@ -1,7 +1,10 @@
+#pragma once
+
 #include "Common.h"
 
 struct RNG {
   RNG() : r(), engine(r()) {}
+  explicit RNG(unsigned int seed) : r(), engine(seed) {}
 
   inline int fromRange(int lo, int hi) {
     std::uniform_int_distribution<int> uniform_dist(lo, hi);
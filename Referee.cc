@@ -0,0 +1,330 @@
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+
+#include "Common.h"
+#include "Elo.h"
+#include "Position.h"
+#include "ThreadPool.h"
+
+// Local stand-in for the CodeCup referee: plays games between two engine
+// commands over the player protocol ("Start", moves, "!" to claim the win,
+// "Quit") and gives each player a total clock for the game. Running out of
+// time, an illegal move or a crash loses the game. Engines swap colors every
+// game and the score is reported for the first one.
+//
+// usage: referee [--games N] [--parallel P] [--time seconds]
+//                "engine1 [args]" "engine2 [args]"
+
+struct Engine {
+  ~Engine() { stop(); }
+
+  bool start(const string &command) {
+    vector<string> args;
+    istringstream in(command);
+    for (string arg; in >> arg;) args.push_back(arg);
+    if (args.empty()) return false;
+
+    // built before fork, the child of a threaded process may only call
+    // async-signal-safe functions
+    vector<char *> argv;
+    for (auto &arg : args) argv.push_back(arg.data());
+    argv.push_back(nullptr);
+
+    // close-on-exec keeps the pipes of other games out of this child, and
+    // closes the status pipe on a successful exec: the parent reads either
+    // the errno of a failed exec or the end of the pipe
+    int toEngine[2], fromEngine[2], status[2];
+    if (pipe2(toEngine, O_CLOEXEC) != 0) return false;
+    if (pipe2(fromEngine, O_CLOEXEC) != 0) {
+      closePipe(toEngine);
+      return false;
+    }
+    if (pipe2(status, O_CLOEXEC) != 0) {
+      closePipe(toEngine);
+      closePipe(fromEngine);
+      return false;
+    }
+    pid = fork();
+    if (pid == 0) {
+      dup2(toEngine[0], STDIN_FILENO);
+      dup2(fromEngine[1], STDOUT_FILENO);
+      int devNull = open("/dev/null", O_WRONLY);
+      if (devNull >= 0) dup2(devNull, STDERR_FILENO);
+      execvp(argv[0], argv.data());
+      int error = errno;
+      if (write(status[1], &error, sizeof(error))) {}
+      _exit(127);
+    }
+    close(toEngine[0]);
+    close(fromEngine[1]);
+    close(status[1]);
+    int error = 0;
+    if (pid > 0) {
+      ssize_t n;
+      do n = read(status[0], &error, sizeof(error));
+      while (n < 0 && errno == EINTR);
+      if (n > 0) waitpid(pid, nullptr, 0);
+      else error = 0;
+    }
+    close(status[0]);
+    if (pid < 0 || error) {
+      if (error) cerr << argv[0] << ": " << strerror(error) << endl;
+      close(toEngine[1]);
+      close(fromEngine[0]);
+      pid = -1;
+      return false;
+    }
+    input = toEngine[1];
+    output = fromEngine[0];
+    return true;
+  }
+
+  static void closePipe(int fds[2]) {
+    close(fds[0]);
+    close(fds[1]);
+  }
+
+  bool send(const string &line) {
+    auto data = line + "\n";
+    return write(input, data.data(), data.size()) ==
+           static_cast<ssize_t>(data.size());
+  }
+
+  // false when the engine closed its output or timeout seconds passed
+  bool readLine(string &line, double timeout) {
+    const auto start = getTimePoint();
+    for (;;) {
+      auto end = buffer.find('\n');
+      if (end != string::npos) {
+        line = buffer.substr(0, end);
+        buffer.erase(0, end + 1);
+        return true;
+      }
+      auto left = timeout - getDeltaTimeSince(start);
+      if (left <= 0.0) return false;
+      pollfd fd{output, POLLIN, 0};
+      int ready = poll(&fd, 1, static_cast<int>(ceil(1000.0 * left)));
+      if (ready < 0 && errno == EINTR) continue;
+      if (ready <= 0) return false;
+      char chunk[256];
+      auto n = read(output, chunk, sizeof(chunk));
+      if (n <= 0) return false;
+      buffer.append(chunk, n);
+    }
+  }
+
+  // asks the engine to quit and kills it if it does not within a second
+  void stop() {
+    if (pid <= 0) return;
+    send("Quit");
+    close(input);
+    close(output);
+    int status;
+    for (int i = 0; i < 100 && waitpid(pid, &status, WNOHANG) == 0; ++i) {
+      usleep(10000);
+    }
+    if (waitpid(pid, &status, WNOHANG) == 0) {
+      kill(pid, SIGKILL);
+      waitpid(pid, &status, 0);
+    }
+    pid = -1;
+  }
+
+  pid_t pid = -1;
+  int input = -1;
+  int output = -1;
+  string buffer;
+};
+
+struct MatchConfig {
+  string engines[2];
+  int games = 100;
+  int parallel = ThreadPool::defaultThreadsCount();
+  double time = 30.0;
+};
+
+// per game, index 0 is the first engine and 1 the second one
+struct GameResult {
+  int white;
+  int winner;
+  int turns = 0;
+  // why the loser lost when the game did not end on the board
+  string forfeit;
+  // set when an engine could not be started, the game was not played
+  string error;
+  double time[2] = {};
+  double maxMoveTime[2] = {};
+  int claims[2] = {};
+  int wrongClaims[2] = {};
+};
+
+GameResult playGame(const MatchConfig &config, int game) {
+  GameResult result;
+  result.white = game % 2;
+  Engine engines[2];
+  for (int e = 0; e < 2; ++e) {
+    if (!engines[e].start(config.engines[e])) {
+      result.error = "cannot start engine" + to_string(e + 1) + " \"" +
+                     config.engines[e] + "\"";
+      return result;
+    }
+  }
+
+  Position pos;
+  string lastMove = "Start";
+  bool claimed[2] = {};
+  int player = result.white;
+  for (; !pos.isEndGame(); player = 1 - player) {
+    auto &engine = engines[player];
+    const auto start = getTimePoint();
+    string reply;
+    bool answered = engine.send(lastMove) &&
+                    engine.readLine(reply, config.time - result.time[player]);
+    auto dt = getDeltaTimeSince(start);
+    result.time[player] += dt;
+    result.maxMoveTime[player] = max(result.maxMoveTime[player], dt);
+    if (!answered) {
+      result.forfeit = result.time[player] >= config.time ? "timeout" : "crash";
+      break;
+    }
+
+    bool claim = !reply.empty() && reply.back() == '!';
+    if (claim) reply.pop_back();
+    Move move;
+    if (!pos.getLegalMove(reply, move)) {
+      result.forfeit = "illegal move " + reply;
+      break;
+    }
+    if (claim && !claimed[player]) {
+      claimed[player] = true;
+      ++result.claims[player];
+    }
+    pos.doMove(move);
+    lastMove = reply;
+  }
+  // the player to move loses, whether it has no move left or forfeited
+  result.winner = 1 - player;
+  result.turns = pos.turns;
+  for (int e = 0; e < 2; ++e) {
+    if (claimed[e] && result.winner != e) ++result.wrongClaims[e];
+  }
+  return result;
+}
+
+struct Summary {
+  void add(const GameResult &r) {
+    ++games;
+    wins += r.winner == 0;
+    whiteGames += r.white == 0;
+    whiteWins += r.white == 0 && r.winner == 0;
+    turns += r.turns;
+    for (int e = 0; e < 2; ++e) {
+      time[e] += r.time[e];
+      maxTime[e] = max(maxTime[e], r.time[e]);
+      maxMoveTime[e] = max(maxMoveTime[e], r.maxMoveTime[e]);
+      claims[e] += r.claims[e];
+      wrongClaims[e] += r.wrongClaims[e];
+      forfeits[e] += !r.forfeit.empty() && r.winner != e;
+    }
+  }
+
+  void print(ostream &out, const MatchConfig &config) const {
+    out << fixed << setprecision(2);
+    out << "engine1: " << config.engines[0] << endl;
+    out << "engine2: " << config.engines[1] << endl;
+    out << "games=" << games << " wins=" << wins << " losses=" << games - wins
+        << " score=" << 100.0 * wins / max(games, 1) << "%"
+        << " (as white " << whiteWins << "/" << whiteGames << ", as black "
+        << wins - whiteWins << "/" << games - whiteGames << ")" << endl;
+    out << estimateElo(wins, games) << endl;
+    out << "average-turns=" << static_cast<double>(turns) / max(games, 1)
+        << endl;
+    for (int e = 0; e < 2; ++e) {
+      out << "engine" << e + 1 << ": time/game=" << time[e] / max(games, 1)
+          << "s max-time/game=" << maxTime[e]
+          << "s max-time/move=" << maxMoveTime[e] << "s claims=" << claims[e]
+          << " wrong-claims=" << wrongClaims[e] << " forfeits=" << forfeits[e]
+          << endl;
+    }
+  }
+
+  int games = 0;
+  int wins = 0;
+  int whiteGames = 0;
+  int whiteWins = 0;
+  long long turns = 0;
+  double time[2] = {};
+  double maxTime[2] = {};
+  double maxMoveTime[2] = {};
+  int claims[2] = {};
+  int wrongClaims[2] = {};
+  int forfeits[2] = {};
+};
+
+int main(int argc, char *argv[]) {
+  MatchConfig config;
+  vector<string> engines;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--games" && i + 1 < argc) {
+      config.games = max(1, stoi(argv[++i]));
+    } else if (arg == "--parallel" && i + 1 < argc) {
+      config.parallel = max(1, stoi(argv[++i]));
+    } else if (arg == "--time" && i + 1 < argc) {
+      config.time = stod(argv[++i]);
+    } else {
+      engines.push_back(arg);
+    }
+  }
+  if (engines.size() != 2) {
+    cerr << "usage: referee [--games N] [--parallel P] [--time seconds] "
+            "\"engine1 [args]\" \"engine2 [args]\""
+         << endl;
+    return 1;
+  }
+  config.engines[0] = engines[0];
+  config.engines[1] = engines[1];
+
+  // a dead engine must not kill the referee when it is sent a move
+  signal(SIGPIPE, SIG_IGN);
+
+  Summary summary;
+  mutex m;
+  // a game whose engine could not start stops the match
+  atomic<bool> failed{false};
+  {
+    ThreadPool pool(config.parallel);
+    vector<future<void>> games;
+    for (int g = 0; g < config.games; ++g) {
+      games.push_back(pool.submit([&, g] {
+        if (failed) return;
+        auto result = playGame(config, g);
+        lock_guard<mutex> lock(m);
+        if (!result.error.empty()) {
+          if (!failed.exchange(true)) cerr << result.error << endl;
+          return;
+        }
+        summary.add(result);
+        cerr << "game " << g + 1 << ": engine" << result.winner + 1
+             << " wins in " << result.turns << " turns, engine1 "
+             << (result.white == 0 ? "white" : "black");
+        if (!result.forfeit.empty()) cerr << " (" << result.forfeit << ")";
+        cerr << ", score " << summary.wins << "/" << summary.games << endl;
+      }));
+    }
+    for (auto &game : games) game.get();
+  }
+  if (failed) return 1;
+
+  summary.print(cout, config);
+  return 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Common.h"
+#include "NNAgent.h"
+
+// Fixed-capacity ring buffer of self-play examples: O(1) insertion (the
+// oldest example is overwritten once full) and O(1) uniform sampling by
+// index.
+//
+// Memory: one Example per slot, sizeof(Example) == 16 bytes (8-byte state,
+// 4-byte value, 4 bytes of padding), allocated up front, so the default
+// capacity of 1M examples costs 16 MB. The 8 symmetric images are not
+// stored; training draws one per sampled example when building a minibatch.
+struct ReplayBuffer {
+  static constexpr size_t defaultCapacity = 1000000;
+
+  explicit ReplayBuffer(size_t capacity = defaultCapacity)
+      : items(max<size_t>(capacity, 1)), next(0), count(0) {}
+
+  void push(const Example &example) {
+    items[next] = example;
+    if (++next == items.size()) next = 0;
+    if (count < items.size()) ++count;
+  }
+
+  // i-th oldest example
+  const Example &operator[](size_t i) const {
+    size_t index = next + items.size() - count + i;
+    if (index >= items.size()) index -= items.size();
+    return items[index];
+  }
+
+  const Example &sample(RNG &gen) const {
+    assert(count > 0);
+    return (*this)[gen.lessThan(static_cast<int>(count))];
+  }
+
+  size_t size() const { return count; }
+  size_t capacity() const { return items.size(); }
+  bool empty() const { return count == 0; }
+
+  vector<Example> items;
+  size_t next;
+  size_t count;
+};
+
+static_assert(sizeof(Example) == 16, "update the memory note above");
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <sstream>
+
+#include "Common.h"
+
+// Counters of one McRaveAgent search, reset at every move. They are only
+// updated when built with ZUNIQ_WITH_STATS, otherwise add() is empty and the
+// compiler drops the updates.
+struct SearchStats {
+#ifdef ZUNIQ_WITH_STATS
+  static constexpr bool enabled = true;
+#else
+  static constexpr bool enabled = false;
+#endif
+
+  long long iterations = 0;
+  // tree lookups while descending, a miss ends the descent
+  long long treeHits = 0;
+  long long treeMisses = 0;
+  long long expansions = 0;
+  // leaves left unexpanded because the tree is full
+  long long droppedNodes = 0;
+  // nodes erased to make room in a full tree
+  long long evictedNodes = 0;
+  // getWinningAction calls for leaves with at most 5 actions
+  long long solverCalls = 0;
+  long long playoutSolverCalls = 0;
+  long long provenWins = 0;
+  long long provenLosses = 0;
+  long long playouts = 0;
+  long long networkSamples = 0;
+  // sum of the number of tree levels of all iterations
+  long long descentDepth = 0;
+  long long cleanedNodes = 0;
+  double cleanTime = 0.0;
+
+  static void add(long long &counter, long long n = 1) {
+    if constexpr (enabled) counter += n;
+  }
+
+  static void add(double &counter, double x) {
+    if constexpr (enabled) counter += x;
+  }
+
+  void reset() { *this = {}; }
+
+  void writeJson(ostream &out) const {
+    auto lookups = treeHits + treeMisses;
+    out << "{\"iterations\": " << iterations << ", \"treeHits\": " << treeHits
+        << ", \"treeMisses\": " << treeMisses << ", \"hitRate\": "
+        << (lookups ? static_cast<double>(treeHits) / lookups : 0.0)
+        << ", \"expansions\": " << expansions
+        << ", \"droppedNodes\": " << droppedNodes
+        << ", \"evictedNodes\": " << evictedNodes
+        << ", \"solverCalls\": " << solverCalls
+        << ", \"playoutSolverCalls\": " << playoutSolverCalls
+        << ", \"provenWins\": " << provenWins
+        << ", \"provenLosses\": " << provenLosses
+        << ", \"playouts\": " << playouts
+        << ", \"networkSamples\": " << networkSamples
+        << ", \"averageDepth\": "
+        << (iterations ? static_cast<double>(descentDepth) / iterations : 0.0)
+        << ", \"cleanedNodes\": " << cleanedNodes
+        << ", \"cleanTime\": " << cleanTime << "}";
+  }
+};
+
+// writes line and a newline, resuming short and interrupted writes. A line
+// of at most PIPE_BUF bytes goes in a single write(), so the lines of
+// several writers sharing a pipe do not interleave.
+inline bool writeLine(int fd, const string &line) {
+  auto data = line + "\n";
+  for (size_t done = 0; done < data.size();) {
+    auto n = write(fd, data.data() + done, data.size() - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    done += n;
+  }
+  return true;
+}
+
+// one JSON object per line
+inline void writeRecord(int fd, const string &record) {
+  if (fd < 0) return;
+  if (!writeLine(fd, record)) {
+    cerr << "cannot write the search record to fd " << fd << endl;
+  }
+}
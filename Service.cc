@@ -0,0 +1,113 @@
+#include "Service.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+void Service::Connection::start() {
+  lock_guard<mutex> lock(m);
+  ++pending;
+}
+
+void Service::Connection::finish(const string &answer) {
+  lock_guard<mutex> lock(m);
+  if (!answer.empty()) {
+    if (!writeLine(fd, answer)) {
+      clog << "cannot answer on fd " << fd << endl;
+    }
+  }
+  if (--pending == 0) idle.notify_all();
+}
+
+void Service::Connection::wait() {
+  unique_lock<mutex> lock(m);
+  idle.wait(lock, [this] { return pending == 0; });
+}
+
+void Service::serve(int input, int output) {
+  auto connection = make_shared<Connection>(output);
+  unordered_map<string, shared_ptr<Game>> games;
+  string buffer;
+  char chunk[4096];
+  for (ssize_t n; (n = read(input, chunk, sizeof(chunk))) > 0;) {
+    buffer.append(chunk, n);
+    for (auto end = buffer.find('\n'); end != string::npos;
+         end = buffer.find('\n')) {
+      istringstream line(buffer.substr(0, end));
+      buffer.erase(0, end + 1);
+      string id, command;
+      if (!(line >> id >> command)) continue;
+
+      if (command == "Quit") {
+        games.erase(id);
+        continue;
+      }
+      auto &game = games[id];
+      if (!game) {
+        game = make_shared<Game>();
+        if (!configure(game->agent)) {
+          clog << "game " << id << ": cannot configure its agent" << endl;
+          games.erase(id);
+          continue;
+        }
+        game->agent.pickTransformation();
+      }
+
+      // time spent waiting for a worker counts against the game's clock
+      const auto received = getTimePoint();
+      connection->start();
+      pool.submit([game, connection, id, command, received] {
+        lock_guard<mutex> lock(game->m);
+        if (command != "Start") {
+          Move move;
+          if (!game->pos.getLegalMove(command, move)) {
+            clog << "game " << id << ": illegal move " << command << endl;
+            connection->finish("");
+            return;
+          }
+          game->pos.doMove(move);
+        }
+        if (game->pos.isEndGame()) {
+          connection->finish("");
+          return;
+        }
+        auto &agent = game->agent;
+        agent.clock.totalTime += getDeltaTimeSince(received);
+        auto [claimWin, bestMove] = agent.getBestMove(game->pos);
+        game->pos.doMove(bestMove);
+        connection->finish(id + " " + showWall(bestMove.wall) +
+                           (claimWin ? "!" : ""));
+      });
+    }
+  }
+  connection->wait();
+}
+
+bool Service::listen(const string &path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) return false;
+  path.copy(address.sun_path, path.size());
+  unlink(path.c_str());
+
+  int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server < 0) return false;
+  if (bind(server, reinterpret_cast<sockaddr *>(&address), sizeof(address)) ||
+      ::listen(server, 64)) {
+    close(server);
+    return false;
+  }
+  clog << "listening on " << path << endl;
+  for (int client; (client = accept(server, nullptr, nullptr)) >= 0;) {
+    thread([this, client] {
+      serve(client, client);
+      close(client);
+    }).detach();
+  }
+  close(server);
+  return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include "Common.h"
+#include "McRaveAgent.h"
+#include "ThreadPool.h"
+
+// Plays many games in one process. Every input line is "<game> <command>",
+// the command being what runProtocol reads (Start, the opponent's move or
+// Quit), and every answer is "<game> <move>" with "!" when claiming the win.
+// Each live game has its own agent and clock, the opening book is shared,
+// and the searches of all games run on one thread pool. Game ids belong to
+// the connection they arrive on.
+struct Service {
+  struct Game {
+    McRaveAgent agent;
+    Position pos;
+    // a game searches one move at a time
+    mutex m;
+  };
+
+  // answers of all the games of a connection, one write per line
+  struct Connection {
+    explicit Connection(int fd) : fd(fd) {}
+
+    void start();
+    // writes the answer of a search started before, if any
+    void finish(const string &answer);
+    // blocks until every search started is finished
+    void wait();
+
+    int fd;
+    int pending = 0;
+    mutex m;
+    condition_variable idle;
+  };
+
+  Service(int threads, function<bool(McRaveAgent &)> configure)
+      : configure(move(configure)), pool(threads) {}
+
+  // serves the games of one connection until its input is closed
+  void serve(int input, int output);
+  // serves every connection made to the Unix socket at path
+  bool listen(const string &path);
+
+  function<bool(McRaveAgent &)> configure;
+  ThreadPool pool;
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+#include "Common.h"
+
+// Persistent worker threads. Submitted tasks always go first; a worker with
+// nothing queued runs the optional idle job (one unit of background work,
+// e.g. a self-play game) and checks the queue again.
+struct ThreadPool {
+  explicit ThreadPool(int threadsCount = defaultThreadsCount(),
+                      function<void()> idleJob = {})
+      : idle(move(idleJob)) {
+    for (int i = 0; i < threadsCount; ++i) {
+      workers.emplace_back([this] { work(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      lock_guard<mutex> lock(m);
+      stopping = true;
+    }
+    cv.notify_all();
+    for (auto &worker : workers) worker.join();
+  }
+
+  static int defaultThreadsCount() {
+    return max(1u, thread::hardware_concurrency());
+  }
+
+  int size() const { return static_cast<int>(workers.size()); }
+
+  template <typename F>
+  auto submit(F f) -> future<decltype(f())> {
+    auto task = make_shared<packaged_task<decltype(f())()>>(move(f));
+    auto result = task->get_future();
+    {
+      lock_guard<mutex> lock(m);
+      tasks.emplace([task] { (*task)(); });
+    }
+    cv.notify_one();
+    return result;
+  }
+
+  void work() {
+    for (;;) {
+      function<void()> task;
+      {
+        unique_lock<mutex> lock(m);
+        cv.wait(lock, [this] { return stopping || !tasks.empty() || idle; });
+        if (stopping) return;
+        if (!tasks.empty()) {
+          task = move(tasks.front());
+          tasks.pop();
+        }
+      }
+      if (task) {
+        task();
+      } else {
+        idle();
+      }
+    }
+  }
+
+  function<void()> idle;
+  vector<thread> workers;
+  queue<function<void()>> tasks;
+  mutex m;
+  condition_variable cv;
+  bool stopping = false;
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Common.h"
+
+// CodeCup gives each player 30s for the whole game. Before turn 18 a move
+// gets 2s, then half of the remaining time but no more than 2.75s. Past that
+// deadline the search goes on for up to maxCheckTime while the best move is
+// not the most visited one.
+struct TimeManager {
+  static constexpr double r = 1.0;
+  static constexpr double defaultMaxTime = r * 2.0;
+  static constexpr double maxCheckTime = r * 0.25;
+  static constexpr double maxTotalTime = r * 30.0;
+  static constexpr double timeTroubleThreshold = r * 25.0;
+
+  double getMaxTime(int turns) const {
+    auto maxTime = defaultMaxTime;
+    if (turns >= 18) {
+      const double maxMoveTime = 2.75;
+      maxTime = min(maxMoveTime, (maxTotalTime - totalTime) / 2);
+    }
+    return maxTime;
+  }
+
+  template <typename F>
+  bool isTimeUp(double elapsed, double maxTime, F mostVisitedIsBest) const {
+    if (elapsed >= maxTime + maxCheckTime) return true;
+    return elapsed >= maxTime && mostVisitedIsBest();
+  }
+
+  // 100 millisconds for maximum reading/writing overhead
+  double totalTime = 0.1;
+};
@@ -1,21 +1,75 @@
-
 #include "NNAgent.h"
+#include "OpeningBook.h"
 #include "Position.h"
+#include "Protocol.h"
+#include "TimeManager.h"
 
 const string bestPath = "./best.ann";
 
-int main() {
-  Position pos;
-  NNAgent agent(bestPath);
-  for (string s; cin >> s && s != "Quit";) {
-    if (s != "Start") {
-      pos.doMove(s);
+// Plays NNAgent under the CodeCup clock with the same time management,
+// opening book and win claims as the McRaveAgent player.
+struct ZeroPlayer {
+  explicit ZeroPlayer(NNAgent &agent) : agent(agent) {
+    book.pickTransformation(gen);
+  }
+
+  pair<bool, Move> getBestMove(const Position &pos) {
+    cerr << fixed << setprecision(2);
+    const auto start = getTimePoint();
+
+    if (Move bookMove; book.find(pos, bookMove)) {
+      cerr << "From opening book" << endl;
+      clock.totalTime += getDeltaTimeSince(start);
+      return {false, bookMove};
+    }
+
+    auto maxTime = clock.getMaxTime(pos.turns);
+    cerr << "max-time=" << maxTime << endl;
+
+    agent.prepareRoot(pos);
+    int i = 0;
+    for (; i < maxIterations; ++i) {
+      agent.simulate(pos);
+      if (clock.isTimeUp(getDeltaTimeSince(start), maxTime, [&] {
+            return agent.select(pos) == agent.selectMostVisited(pos);
+          })) {
+        break;
+      }
     }
 
-    auto bestMove = agent.getBestMove(pos);
-    pos.doMove(bestMove);
-    cout << bestMove << endl;
+    auto bestMove = agent.selectMostVisited(pos);
+    const float value = agent.m[pos.state].actionInfo[bestMove.wall].q.value;
+    auto dt = getDeltaTimeSince(start);
+    clock.totalTime += dt;
+    cerr << "i=" << i << " dt=" << dt << " tt=" << clock.totalTime
+         << " v=" << value << " " << *agent.cache << endl;
+
+    auto next = pos;
+    next.doMove(bestMove);
+    bool claimWin = canClaimWin && (next.isEndGame() ||
+                                    (pos.turns >= 18 && value >= 0.34f));
+    if (claimWin) canClaimWin = false;
+    return {claimWin, bestMove};
   }
 
+  NNAgent &agent;
+  RNG gen;
+  TimeManager clock;
+  OpeningBookLookup book;
+  bool canClaimWin = true;
+  static constexpr int maxIterations = 200000;
+};
+
+int main(int argc, char *argv[]) {
+  NNAgent agent(bestPath);
+  if (argc > 2 && argv[1] == string("--int8")) {
+    if (!agent.useQuantized(argv[2])) return 1;
+    cerr << "Using int8 network " << argv[2] << " ("
+         << QuantizedNetwork::kernelName() << ")" << endl;
+  }
+
+  ZeroPlayer player(agent);
+  runProtocol([&](const Position &pos) { return player.getBestMove(pos); });
+
   return 0;
 }
@@ -1,6 +1,12 @@
+#include <fstream>
+#include <sstream>
+
 #include "Common.h"
 #include "McRaveAgent.h"
 #include "Position.h"
+#include "Protocol.h"
+#include "Service.h"
+#include "ThreadPool.h"
 
 struct OpeningEntry {
   Bitmask placed;
@@ -44,6 +50,223 @@ void generateOpening(int turn) {
   generateOpening(pos, agent, 0, turn);
 }
 
+// search options, accepted after any mode
+bool configure(McRaveAgent &agent, int argc, char *argv[]) {
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--scalar-playouts") {
+      agent.batchedPlayouts = false;
+    } else if (arg == "--phase-timers") {
+#ifndef ZUNIQ_WITH_TIMERS
+      cerr << "--phase-timers needs a build with ZUNIQ_WITH_TIMERS" << endl;
+#endif
+      agent.phaseTimers = true;
+    }
+    if (i + 1 == argc) break;
+
+    if (arg == "--value-net") {
+      if (!agent.useValueNetwork(argv[++i])) return false;
+      cerr << "Using value network " << argv[i] << " ("
+           << QuantizedNetwork::kernelName() << ")" << endl;
+    } else if (arg == "--prior-visits") {
+      agent.priorVisits = max(0, stoi(argv[++i]));
+    } else if (arg == "--network-samples") {
+      agent.networkSamples = max(0, stoi(argv[++i]));
+    } else if (arg == "--min-samples") {
+      agent.sampling.minSamples = max(1, stoi(argv[++i]));
+    } else if (arg == "--max-samples") {
+      agent.sampling.maxSamples = max(1, stoi(argv[++i]));
+    } else if (arg == "--stop-margin") {
+      agent.sampling.stopMargin = stof(argv[++i]);
+    } else if (arg == "--playout-solver") {
+      int threshold = stoi(argv[++i]);
+      agent.playoutSolverThreshold =
+          max(0, min(McRaveAgent::maxPlayoutSolverThreshold, threshold));
+    } else if (arg == "--stats-fd") {
+      agent.statsFd = stoi(argv[++i]);
+    } else if (arg == "--max-nodes") {
+      agent.maxNodes = max(1, stoi(argv[++i]));
+    } else if (arg == "--tree-mb") {
+      agent.setTreeBudget(max(1, stoi(argv[++i])));
+    } else if (arg == "--huge-pages") {
+      string mode = argv[++i];
+      if (mode != "thp" && mode != "hugetlb") {
+        cerr << "--huge-pages takes thp or hugetlb" << endl;
+        return false;
+      }
+      agent.pageMode =
+          mode == "thp" ? PageMode::Transparent : PageMode::HugeTlb;
+    } else if (arg == "--max-iterations") {
+      agent.maxIterations = max(1, stoi(argv[++i]));
+    } else if (arg == "--knowledge") {
+      if (!agent.useKnowledge(argv[++i])) return false;
+    } else if (arg == "--knowledge-visits") {
+      agent.knowledgeVisits = max(0, stoi(argv[++i]));
+    } else if (arg == "--learn") {
+      agent.learnPath = argv[++i];
+    } else if (arg == "--learn-min-visits") {
+      agent.learnMinVisits = max(1, stoi(argv[++i]));
+    }
+  }
+  // whatever the order of the options
+  agent.networkSamples = min(agent.networkSamples, agent.sampling.maxSamples);
+  agent.useSettings(agent);
+  return true;
+}
+
+// the moves played from the start, false when one of them is illegal
+bool parsePosition(const string &line, Position &pos) {
+  istringstream in(line);
+  for (string s; in >> s;) {
+    Move move;
+    if (!pos.getLegalMove(s, move)) return false;
+    pos.doMove(move);
+  }
+  return true;
+}
+
+// Analyzes every position of a file, one line of moves per position, on a
+// thread pool with one agent per worker. Results are printed in the order of
+// the file as CSV, or as JSON lines with --json.
+int analyzePositions(int argc, char *argv[]) {
+  int iterations = 100000;
+  double maxTime = 0.0;
+  int threads = ThreadPool::defaultThreadsCount();
+  bool json = false;
+  for (int i = 3; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--json") {
+      json = true;
+    } else if (i + 1 == argc) {
+      break;
+    } else if (arg == "--iterations") {
+      iterations = max(1, stoi(argv[++i]));
+    } else if (arg == "--time") {
+      maxTime = stod(argv[++i]);
+    } else if (arg == "--threads") {
+      threads = max(1, stoi(argv[++i]));
+    }
+  }
+
+  ifstream in(argv[2]);
+  if (!in) {
+    cerr << "cannot read " << argv[2] << endl;
+    return 1;
+  }
+  vector<string> lines;
+  for (string line; getline(in, line);) lines.push_back(line);
+
+  // network and knowledge are loaded once and shared by the workers
+  McRaveAgent prototype;
+  if (!configure(prototype, argc, argv)) return 1;
+
+  const auto start = getTimePoint();
+  ThreadPool pool(threads);
+  vector<future<string>> rows;
+  for (size_t n = 0; n < lines.size(); ++n) {
+    if (!lines[n].empty() && lines[n][0] == '#') continue;
+    rows.push_back(pool.submit([&, n] {
+      thread_local auto worker = [&] {
+        auto agent = make_unique<McRaveAgent>();
+        agent->useSettings(prototype);
+        return agent;
+      }();
+
+      Position pos;
+      Analysis analysis{};
+      analysis.status = "illegal";
+      if (parsePosition(lines[n], pos)) {
+        analysis.status = "end";
+        if (!pos.isEndGame()) {
+          worker->reseed(n + 1);
+          analysis = worker->analyze(pos, iterations, maxTime);
+        }
+      }
+      bool searched = analysis.iterations > 0;
+      auto best = searched ? showWall(analysis.bestMove.wall) : "";
+
+      ostringstream row;
+      row << fixed << setprecision(4);
+      if (json) {
+        row << "{\"line\": " << n + 1 << ", \"turn\": " << pos.turns + 1
+            << ", \"best\": \"" << best << "\", \"value\": " << analysis.value
+            << ", \"visits\": " << analysis.visits << ", \"status\": \""
+            << analysis.status << "\", \"iterations\": " << analysis.iterations
+            << ", \"time\": " << analysis.time
+            << ", \"depth\": " << analysis.depth << "}";
+      } else {
+        row << n + 1 << "," << pos.turns + 1 << "," << best << ","
+            << analysis.value << "," << analysis.visits << ","
+            << analysis.status << "," << analysis.iterations << ","
+            << analysis.time << "," << analysis.depth;
+      }
+      return row.str();
+    }));
+  }
+
+  if (!json) {
+    cout << "line,turn,best,value,visits,status,iterations,time,depth" << endl;
+  }
+  for (auto &row : rows) cout << row.get() << endl;
+  auto dt = getDeltaTimeSince(start);
+  cerr << fixed << setprecision(2) << "analyzed " << rows.size()
+       << " positions in " << dt << "s with " << threads << " threads, "
+       << rows.size() / dt << " positions/s" << endl;
+  return 0;
+}
+
+// Plays the games multiplexed on stdin/stdout, or on every connection to a
+// Unix socket with --socket path. Search logs are dropped unless --verbose.
+int runService(int argc, char *argv[]) {
+  string socketPath;
+  int threads = ThreadPool::defaultThreadsCount();
+  bool verbose = false;
+  for (int i = 2; i < argc; ++i) {
+    string arg = argv[i];
+    if (arg == "--verbose") {
+      verbose = true;
+    } else if (i + 1 == argc) {
+      break;
+    } else if (arg == "--socket") {
+      socketPath = argv[++i];
+    } else if (arg == "--threads") {
+      threads = max(1, stoi(argv[++i]));
+    }
+  }
+
+  // many trees live at once, so they are smaller than in a single game.
+  // Network and knowledge are loaded once and shared by the games.
+  McRaveAgent prototype;
+  prototype.maxNodes = 20000;
+  if (!configure(prototype, argc, argv)) return 1;
+  if (!prototype.learnPath.empty()) {
+    cerr << "--learn is not supported with --service" << endl;
+    return 1;
+  }
+  // the records of all the games would interleave with no game to tell them
+  if (prototype.statsFd >= 0) {
+    cerr << "--stats-fd is not supported with --service" << endl;
+    return 1;
+  }
+  if (!verbose) cerr.rdbuf(nullptr);
+  // a client leaving must not kill the other games
+  signal(SIGPIPE, SIG_IGN);
+
+  Service service(threads, [&prototype](McRaveAgent &agent) {
+    agent.useSettings(prototype);
+    return true;
+  });
+  if (socketPath.empty()) {
+    service.serve(STDIN_FILENO, STDOUT_FILENO);
+    return 0;
+  }
+  if (!service.listen(socketPath)) {
+    clog << "cannot listen on " << socketPath << endl;
+    return 1;
+  }
+  return 0;
+}
+
 int main(int argc, char *argv[]) {
   if (argc >= 2) {
     if (string(argv[1]) == "--opening-0") {
@@ -86,6 +309,14 @@ int main(int argc, char *argv[]) {
       return 0;
     }
 
+    if (argv[1] == string("--service")) {
+      return runService(argc, argv);
+    }
+
+    if (argv[1] == string("--analyze") && argc >= 3) {
+      return analyzePositions(argc, argv);
+    }
+
     if (argv[1] == string("--check-randomness")) {
       RNG gen;
       Position pos;
@@ -136,6 +367,22 @@ int main(int argc, char *argv[]) {
       cout << "Run " << count << " playouts in " << dt << " seconds" << endl;
       cout << 0.001 * count / dt << "k playout/s" << endl;
       cout << "w=" << 100.0f * wins / count << "%" << endl;
+
+      start = getTimePoint();
+      wins = 0;
+      PlayoutBatch batch;
+      Position pos;
+      for (int i = 0; i < count; i += PlayoutBatch::lanes) {
+        batch.run(pos, gen, PlayoutBatch::lanes);
+        for (int j = 0; j < PlayoutBatch::lanes; ++j) {
+          wins += batch.value[j] > 0.0f;
+        }
+      }
+      dt = getDeltaTimeSince(start);
+      cout << "Batched by " << PlayoutBatch::lanes << ": " << count
+           << " playouts in " << dt << " seconds" << endl;
+      cout << 0.001 * count / dt << "k playout/s" << endl;
+      cout << "w=" << 100.0f * wins / count << "%" << endl;
       return 0;
     }
 
@@ -143,6 +390,7 @@ int main(int argc, char *argv[]) {
       auto start = getTimePoint();
       constexpr int count = 100000;
       McRaveAgent agent;
+      if (!configure(agent, argc, argv)) return 1;
       Position pos;
       for (int i = 0; i < count; ++i) {
         agent.simulate(pos);
@@ -152,6 +400,19 @@ int main(int argc, char *argv[]) {
       cout.setf(ios::fixed);
       cout << "Run " << count << " simulations in " << dt << " seconds" << endl;
       cout << "Speed=" << 0.001 * count / dt << "k it/s" << endl;
+      if (agent.timers.enabled) agent.timers.dump(cout);
+
+      // the tree phase alone: descents through the tree just built,
+      // expanding a leaf while the node limit allows it
+      start = getTimePoint();
+      for (int i = 0; i < count; ++i) {
+        auto tmpPos = pos;
+        IterationResult result;
+        agent.simulateTree(tmpPos, result);
+      }
+      dt = getDeltaTimeSince(start);
+      cout << "Descent=" << 1e6 * dt / count << "us/simulation"
+           << " d=" << agent.getDepth(pos) << endl;
       // Thu Jan 21 23:34:04 CET 2021
       // Run 100000 simulations in 7.41 seconds
       // Speed=13.49k it/s
@@ -159,27 +420,13 @@ int main(int argc, char *argv[]) {
     }
   }
 
-  Position pos;
   McRaveAgent agent;
+  if (!configure(agent, argc, argv)) return 1;
   agent.pickTransformation();
-  for (string s; cin >> s && s != "Quit";) {
-    if (s != "Start") {
-      cerr << s << endl;
-      pos.doMove(s);
-    }
-
-    auto [claimWin, bestMove] = agent.getBestMove(pos);
-    pos.doMove(bestMove);
-    cerr << bestMove;
-    cout << bestMove;
-
-    if (claimWin) {
-      cerr << "!";
-      cout << "!";
-    }
-    cerr << endl;
-    cout << endl;
-  }
+  if (agent.timers.enabled) PhaseTimers::requestDumpOnSignal();
+  runProtocol([&](const Position &pos) { return agent.getBestMove(pos); });
+  if (agent.timers.enabled) agent.timers.dump(cerr);
+  if (!agent.learnPath.empty() && !agent.saveKnowledge()) return 1;
 
   return 0;
 }